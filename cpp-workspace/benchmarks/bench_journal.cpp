@@ -0,0 +1,43 @@
+// Cost of sizing and reserving journal space ahead of a commit.
+
+#include <benchmark/benchmark.h>
+
+#include "ltf_journal_space.h"
+
+using ltf::JournalLayout;
+using ltf::JournalSpaceReserver;
+using ltf::TransactionFootprint;
+
+namespace {
+
+constexpr JournalLayout layout = {
+    4096,           // sector_size
+    512 * 1024,     // segment_size
+    4096,           // segment_header_size
+    256,            // transaction_header_size
+    64,             // nvo_header_size
+};
+
+void BM_transaction_footprint(benchmark::State& state) {
+    for (auto _ : state) {
+        TransactionFootprint footprint(layout);
+        for (int64_t i = 0; i < state.range(0); i++) {
+            footprint.add_nvo(512);
+        }
+        benchmark::DoNotOptimize(footprint.ondisk_usage());
+    }
+}
+BENCHMARK(BM_transaction_footprint)->Arg(1)->Arg(16);
+
+JournalSpaceReserver reserver(1ull << 40);
+
+void BM_journal_try_reserve(benchmark::State& state) {
+    for (auto _ : state) {
+        JournalSpaceReserver::Reservation reservation = reserver.try_reserve(4096);
+        benchmark::DoNotOptimize(reservation.bytes());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_journal_try_reserve)->ThreadRange(1, 8)->UseRealTime();
+
+} // namespace
@@ -0,0 +1,77 @@
+// Cost of resolving a fixed name to an enum: compile-time perfect hash vs
+// the std::unordered_map<std::string, ...> tables it replaces.
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "u_perfect_hash.h"
+
+namespace {
+
+// Same shape as the journal corruption field names
+enum class Field {
+    Magic, Version, GenerationId, SegmentCount, RealHeadSegmentId, Checksum,
+    SegmentId, FirstTransactionOffset, TxnStartSegmentId, RealTailSegmentId,
+    Id, SequenceId, RemovalCount, AddCount, TotalOndiskNvoHeaderSize,
+    TotalOndiskSize, PaddingSize, HeaderChecksum, PartCount, PartChecksums,
+};
+
+constexpr auto perfect_fields = u_make_perfect_hash_map<Field>({
+    { "MAGIC", Field::Magic },
+    { "VERSION", Field::Version },
+    { "GENERATION_ID", Field::GenerationId },
+    { "SEGMENT_COUNT", Field::SegmentCount },
+    { "REAL_HEAD_SEGMENT_ID", Field::RealHeadSegmentId },
+    { "CHECKSUM", Field::Checksum },
+    { "SEGMENT_ID", Field::SegmentId },
+    { "FIRST_TRANSACTION_OFFSET", Field::FirstTransactionOffset },
+    { "TXN_START_SEGMENT_ID", Field::TxnStartSegmentId },
+    { "REAL_TAIL_SEGMENT_ID", Field::RealTailSegmentId },
+    { "ID", Field::Id },
+    { "SEQUENCE_ID", Field::SequenceId },
+    { "REMOVAL_COUNT", Field::RemovalCount },
+    { "ADD_COUNT", Field::AddCount },
+    { "TOTAL_ONDISK_NVO_HEADER_SIZE", Field::TotalOndiskNvoHeaderSize },
+    { "TOTAL_ONDISK_SIZE", Field::TotalOndiskSize },
+    { "PADDING_SIZE", Field::PaddingSize },
+    { "HEADER_CHECKSUM", Field::HeaderChecksum },
+    { "PART_COUNT", Field::PartCount },
+    { "PART_CHECKSUMS", Field::PartChecksums },
+});
+
+const std::unordered_map<std::string, Field>& hashed_fields() {
+    static const std::unordered_map<std::string, Field> fields = [] {
+        std::unordered_map<std::string, Field> map;
+        for (const UPerfectHashEntry<Field>& entry : perfect_fields) {
+            map.emplace(std::string(entry.key), entry.value);
+        }
+        return map;
+    }();
+    return fields;
+}
+
+// Arg 0 looks up a key in the table, arg 1 a key that is not
+const char* lookup_key(int64_t miss) {
+    return miss ? "TOTAL_ONDISK_NVO_SIZE" : "TOTAL_ONDISK_NVO_HEADER_SIZE";
+}
+
+void BM_perfect_hash_find(benchmark::State& state) {
+    const std::string key = lookup_key(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(perfect_fields.find(key));
+    }
+}
+BENCHMARK(BM_perfect_hash_find)->Arg(0)->Arg(1);
+
+void BM_unordered_map_find(benchmark::State& state) {
+    const std::unordered_map<std::string, Field>& fields = hashed_fields();
+    const std::string key = lookup_key(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(fields.find(key));
+    }
+}
+BENCHMARK(BM_unordered_map_find)->Arg(0)->Arg(1);
+
+} // namespace
@@ -0,0 +1,150 @@
+// Per-call cost of the trace front end, the FNV hashes and the trace ring.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include "u_hash.h"
+#include "u_prof.h"
+#include "u_tr.h"
+#include "u_tr_ring.h"
+
+namespace {
+
+// Send formatted trace lines to /dev/null so the benchmark measures u_tr,
+// not the terminal.
+struct DiscardTraceOutput {
+    DiscardTraceOutput()
+    {
+        FILE *null = std::fopen("/dev/null", "w");
+        if (null != nullptr) {
+            u_tr_stream = null;
+        }
+    }
+} discard_trace_output;
+
+void BM_u_tr_literal(benchmark::State& state) {
+    uint32_t thread = 10;
+    for (auto _ : state) {
+        u_tr(T_info, "NK: 66 [Thread %u] Processing removal ", thread);
+    }
+}
+BENCHMARK(BM_u_tr_literal);
+
+// Same call with the contention profiler recording
+void BM_u_tr_literal_profiled(benchmark::State& state) {
+    uint32_t thread = 10;
+    u_prof_enable(true);
+    for (auto _ : state) {
+        u_tr(T_info, "NK: 66 [Thread %u] Processing removal ", thread);
+    }
+    u_prof_enable(false);
+}
+BENCHMARK(BM_u_tr_literal_profiled);
+
+void BM_u_tr_runtime(benchmark::State& state) {
+    const char *fmt = "NK: 66 [Thread %u] Processing removal ";
+    uint32_t thread = 10;
+    for (auto _ : state) {
+        u_tr(T_info, fmt, thread);
+    }
+}
+BENCHMARK(BM_u_tr_runtime);
+
+void BM_u_tr_suppressed(benchmark::State& state) {
+    uint32_t thread = 10;
+    for (auto _ : state) {
+        u_tr(T_dbg, "NK: 66 [Thread %u] Processing removal ", thread);
+    }
+}
+BENCHMARK(BM_u_tr_suppressed);
+
+void BM_u_tr_enabled_check(benchmark::State& state) {
+    int module = U_TR_MODULE_default;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(module);
+        benchmark::DoNotOptimize(u_tr_enabled(module, T_dbg));
+    }
+}
+BENCHMARK(BM_u_tr_enabled_check);
+
+void BM_u_hash(benchmark::State& state) {
+    std::vector<unsigned char> buf(state.range(0), 0xa5);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(u_hash::hash(buf.data(), buf.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_u_hash)->RangeMultiplier(4)->Range(8, 8 << 10);
+
+void BM_fnv1a_32(benchmark::State& state) {
+    std::vector<char> buf(state.range(0), 'x');
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(fnv1a_32(buf.data(), buf.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_fnv1a_32)->RangeMultiplier(4)->Range(8, 8 << 10);
+
+void BM_unhash_hit(benchmark::State& state) {
+    uint32_t hash = compute_fnv_hash_of_label("NK: 66 [Thread %s] Processing removal ");
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hash);
+        benchmark::DoNotOptimize(unhash(hash));
+    }
+}
+BENCHMARK(BM_unhash_hit);
+
+void BM_unhash_miss(benchmark::State& state) {
+    uint32_t hash = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hash);
+        benchmark::DoNotOptimize(unhash(hash));
+    }
+}
+BENCHMARK(BM_unhash_miss);
+
+void BM_u_tr_clock_stamp(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(u_tr_clock.stamp());
+    }
+}
+BENCHMARK(BM_u_tr_clock_stamp);
+
+void BM_clock_gettime_realtime(benchmark::State& state) {
+    timespec ts;
+    for (auto _ : state) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        benchmark::DoNotOptimize(ts);
+    }
+}
+BENCHMARK(BM_clock_gettime_realtime);
+
+UTrRing ring(1 << 16);
+
+void BM_trace_ring_write(benchmark::State& state) {
+    const uint64_t args[2] = { 10, 20 };
+    for (auto _ : state) {
+        ring.write(0x1234, 1, T_info, u_tr_clock.stamp(), args, sizeof(args));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_trace_ring_write)->ThreadRange(1, 8)->UseRealTime();
+
+std::mutex prof_mutex;
+
+// Uncontended with one thread; with more, wait time is what is measured
+void BM_prof_lock_guard(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        u_prof_enable(state.range(0) != 0);
+    }
+    for (auto _ : state) {
+        U_PROF_LOCK_GUARD(prof_mutex, "bench.prof_mutex");
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_prof_lock_guard)->Arg(0)->Arg(1)->ThreadRange(1, 4)->UseRealTime();
+
+} // namespace
@@ -0,0 +1,123 @@
+// Reports journal bytes-on-disk per payload byte for unpacked (one padded
+// transaction per write) and sector-packed commit groups, across several
+// transaction-size distributions.
+//
+// Usage: journal_packing_report [transaction_count]
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+
+#include "ltf_journal_space.h"
+
+using ltf::JournalLayout;
+using ltf::TransactionFootprint;
+using ltf::TransactionPacker;
+
+namespace {
+
+// Same geometry as the writebuffer tests: 512 KiB segments, one sector of
+// segment header.
+constexpr uint32_t sector_size = 4096;
+
+constexpr JournalLayout layout = {
+    sector_size,        // sector_size
+    512 * 1024,         // segment_size
+    sector_size,        // segment_header_size
+    256,                // transaction_header_size
+    64,                 // nvo_header_size
+};
+
+struct Distribution {
+    const char *name;
+    std::function<uint32_t(std::mt19937&)> nvo_size;
+    uint32_t max_nvos;
+};
+
+struct Result {
+    uint64_t payload;
+    uint64_t ondisk;
+    uint64_t padding;
+};
+
+// Journal bytes for `data` bytes of transaction data, segment headers included
+uint64_t
+with_segment_headers(uint64_t data)
+{
+    const uint64_t segments =
+        (data + layout.segment_data_size() - 1) / layout.segment_data_size();
+    return data + segments * layout.segment_header_size;
+}
+
+Result
+run(const Distribution& dist, uint32_t group_size, uint32_t txn_count)
+{
+    std::mt19937 rng(42);                       // same transactions for every mode
+    std::uniform_int_distribution<uint32_t> nvo_count(1, dist.max_nvos);
+
+    Result result = {0, 0, 0};
+    uint64_t data = 0;
+    TransactionPacker packer(layout);
+    auto flush = [&] {
+        data += packer.ondisk_size();
+        result.padding += packer.padding_size();
+        packer.reset();
+    };
+
+    for (uint32_t i = 0; i < txn_count; i++) {
+        TransactionFootprint txn(layout);
+        const uint32_t nvos = nvo_count(rng);
+        for (uint32_t n = 0; n < nvos; n++) {
+            const uint32_t size = dist.nvo_size(rng);
+            txn.add_nvo(size);
+            result.payload += size;
+        }
+        uint64_t offset;
+        if (packer.transaction_count() == group_size || !packer.add(txn, &offset)) {
+            flush();
+            packer.add(txn, &offset);
+        }
+    }
+    flush();
+    result.ondisk = with_segment_headers(data);
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    const uint32_t txn_count = argc > 1 ? std::atoi(argv[1]) : 100000;
+
+    const Distribution distributions[] = {
+        { "fixed_64",        [](std::mt19937&) { return 64u; },  1 },
+        { "fixed_512",       [](std::mt19937&) { return 512u; }, 1 },
+        { "fixed_4k",        [](std::mt19937&) { return 4096u; }, 1 },
+        { "uniform_64_2k",
+          [](std::mt19937& rng) {
+              return std::uniform_int_distribution<uint32_t>(64, 2048)(rng);
+          }, 4 },
+        { "bimodal_128_64k",
+          [](std::mt19937& rng) {
+              return std::bernoulli_distribution(0.9)(rng) ? 128u : 64u * 1024;
+          }, 2 },
+    };
+    const uint32_t group_sizes[] = { 1, 8, 32 };
+
+    std::printf("%-16s %6s %14s %14s %12s %10s\n",
+                "distribution", "group", "payload", "ondisk",
+                "ondisk/byte", "padding%");
+    for (const Distribution& dist : distributions) {
+        for (uint32_t group_size : group_sizes) {
+            const Result r = run(dist, group_size, txn_count);
+            std::printf("%-16s %6u %14llu %14llu %12.3f %9.2f%%\n",
+                        dist.name, group_size,
+                        (unsigned long long)r.payload,
+                        (unsigned long long)r.ondisk,
+                        (double)r.ondisk / (double)r.payload,
+                        100.0 * (double)r.padding / (double)r.ondisk);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,491 @@
+/* Copyright Hewlett Packard Enterprise Development LP. */
+
+/**
+ * @file ltf_journal_space.h
+ * @brief Contains `TransactionFootprint`, `TransactionPacker` and
+ *        `JournalSpaceReserver` - pre-commit sizing, packing and reservation
+ *        of journal segment space.
+ */
+#ifndef LTF_JOURNAL_SPACE_H
+#define LTF_JOURNAL_SPACE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include "u_prof.h"
+
+namespace ltf {
+
+/**
+ * @struct JournalLayout
+ *
+ * @brief On-disk geometry of a DSP journal, as needed to size a transaction
+ *        before it is committed.
+ */
+struct JournalLayout {
+    /** @brief FORMAT_sector_size; transactions are padded to this boundary. */
+    uint32_t sector_size;
+
+    /** @brief Size of one journal segment, including its header. */
+    uint32_t segment_size;
+
+    /** @brief Bytes reserved at the start of every segment for its header. */
+    uint32_t segment_header_size;
+
+    /** @brief Size of the fixed part of the transaction header. */
+    uint32_t transaction_header_size;
+
+    /** @brief Size of the on-disk header written in front of each NVO. */
+    uint32_t nvo_header_size;
+
+    /** @brief Bytes of a segment available to transaction data. */
+    uint32_t
+    segment_data_size() const
+    {
+        return segment_size - segment_header_size;
+    }
+
+    /**
+     * @brief Transaction data that @p segment_count unused segments hold;
+     *        the capacity to give a JournalSpaceReserver.
+     */
+    uint64_t
+    data_capacity(uint64_t segment_count) const
+    {
+        return segment_count * segment_data_size();
+    }
+};
+
+/**
+ * @class TransactionFootprint
+ *
+ * @brief Computes the on-disk size of a transaction from the NVOs it will
+ *        carry, using the same rules the commit path uses to fill in the
+ *        TOTAL_ONDISK_NVO_HEADER_SIZE, PADDING_SIZE and TOTAL_ONDISK_SIZE
+ *        transaction header fields.
+ */
+class TransactionFootprint {
+public: /* Constructor */
+    explicit TransactionFootprint(const JournalLayout& layout)
+        : _layout(layout),
+          _nvo_count(0),
+          _payload_size(0)
+    {}
+
+public: /* Functions */
+    /**
+     * @brief Account for one NVO in the transaction.
+     *
+     * @param[in] payload_size  Size of the NVO payload in bytes.
+     */
+    void
+    add_nvo(uint64_t payload_size)
+    {
+        _nvo_count++;
+        _payload_size += payload_size;
+    }
+
+    /** @brief Number of NVOs added so far. */
+    uint32_t
+    nvo_count() const
+    {
+        return _nvo_count;
+    }
+
+    /** @brief Sum of the NVO payload sizes. */
+    uint64_t
+    payload_size() const
+    {
+        return _payload_size;
+    }
+
+    /** @brief Value of the TOTAL_ONDISK_NVO_HEADER_SIZE header field. */
+    uint64_t
+    total_ondisk_nvo_header_size() const
+    {
+        return static_cast<uint64_t>(_nvo_count) * _layout.nvo_header_size;
+    }
+
+    /** @brief Headers plus payload, before padding to the sector size. */
+    uint64_t
+    unpadded_size() const
+    {
+        return _layout.transaction_header_size + total_ondisk_nvo_header_size() +
+               _payload_size;
+    }
+
+    /** @brief Value of the PADDING_SIZE header field. */
+    uint32_t
+    padding_size() const
+    {
+        const uint64_t unpadded = unpadded_size();
+        const uint64_t remainder = unpadded % _layout.sector_size;
+        return remainder == 0 ? 0
+                              : static_cast<uint32_t>(_layout.sector_size - remainder);
+    }
+
+    /** @brief Value of the TOTAL_ONDISK_SIZE header field. */
+    uint64_t
+    total_ondisk_size() const
+    {
+        return unpadded_size() + padding_size();
+    }
+
+    /**
+     * @brief Most segments the transaction can touch: the count when it
+     *        starts at a fresh segment. One that starts mid-segment may
+     *        touch one more.
+     */
+    uint32_t
+    segment_count() const
+    {
+        const uint64_t data_size = _layout.segment_data_size();
+        return static_cast<uint32_t>((total_ondisk_size() + data_size - 1) / data_size);
+    }
+
+    /**
+     * @brief Journal space consumed by the transaction, with the header of
+     *        every segment it spans from a fresh segment. This is the value
+     *        sync_commit() reports as ondisk_usage.
+     */
+    uint64_t
+    ondisk_usage() const
+    {
+        return total_ondisk_size() +
+               static_cast<uint64_t>(segment_count()) * _layout.segment_header_size;
+    }
+
+private: /* Data members */
+    /** @brief Journal geometry the footprint is computed against. */
+    JournalLayout _layout;
+
+    /** @brief Number of NVOs in the transaction. */
+    uint32_t _nvo_count;
+
+    /** @brief Sum of the NVO payload sizes. */
+    uint64_t _payload_size;
+}; /* class TransactionFootprint */
+
+/**
+ * @class TransactionPacker
+ *
+ * @brief Lays out a group of transactions committed together back to back
+ *        within sectors, so only the last one in the group carries
+ *        PADDING_SIZE. Each transaction still has its own header and NVO
+ *        headers and is recovered on its own; only its start offset is no
+ *        longer sector aligned.
+ *
+ * A group never grows past one segment's data area, except that a single
+ * transaction larger than that is accepted on its own and spans segments
+ * as it would unpacked.
+ */
+class TransactionPacker {
+public: /* Constructor */
+    explicit TransactionPacker(const JournalLayout& layout)
+        : _layout(layout),
+          _transaction_count(0),
+          _packed_size(0)
+    {}
+
+public: /* Functions */
+    /**
+     * @brief Append a transaction to the group.
+     *
+     * @param[in]  transaction  Footprint of the transaction to append.
+     * @param[out] out_offset   Byte offset of its header within the group.
+     * @return false if the group is full; write it out and reset() first.
+     */
+    bool
+    add(const TransactionFootprint& transaction, uint64_t* out_offset)
+    {
+        const uint64_t size = transaction.unpadded_size();
+        if (_transaction_count > 0 &&
+            _round_up(_packed_size + size) > _layout.segment_data_size()) {
+            return false;
+        }
+        *out_offset = _packed_size;
+        _packed_size += size;
+        _transaction_count++;
+        return true;
+    }
+
+    /** @brief Number of transactions in the group. */
+    uint32_t
+    transaction_count() const
+    {
+        return _transaction_count;
+    }
+
+    /** @brief PADDING_SIZE of the last transaction in the group. */
+    uint32_t
+    padding_size() const
+    {
+        return static_cast<uint32_t>(_round_up(_packed_size) - _packed_size);
+    }
+
+    /** @brief Bytes written for the group, padding included. */
+    uint64_t
+    ondisk_size() const
+    {
+        return _round_up(_packed_size);
+    }
+
+    /** @brief Start a new, empty group. */
+    void
+    reset()
+    {
+        _transaction_count = 0;
+        _packed_size = 0;
+    }
+
+private: /* Helper functions */
+    uint64_t
+    _round_up(uint64_t size) const
+    {
+        const uint64_t sector = _layout.sector_size;
+        return (size + sector - 1) / sector * sector;
+    }
+
+private: /* Data members */
+    /** @brief Journal geometry the group is packed against. */
+    JournalLayout _layout;
+
+    /** @brief Number of transactions in the group. */
+    uint32_t _transaction_count;
+
+    /** @brief Sum of the unpadded transaction sizes in the group. */
+    uint64_t _packed_size;
+}; /* class TransactionPacker */
+
+/**
+ * @class JournalSpaceReserver
+ *
+ * @brief Tracks free journal space and hands it out to transactions before
+ *        they are built, so callers see journal-full as backpressure rather
+ *        than as a failed commit.
+ *
+ * Space is counted in segment data-area bytes: the capacity is
+ * JournalLayout::data_capacity() of the unused segments, so their headers
+ * are accounted for once, and each transaction reserves its
+ * TransactionFootprint::total_ondisk_size(). Reserving ondisk_usage()
+ * instead would charge every transaction for headers as if it started a
+ * fresh segment and turn transactions away long before the journal is full.
+ *
+ * Space is returned with release(), either when a reservation is abandoned
+ * or when the tail advances and frees written segments.
+ */
+class JournalSpaceReserver {
+public: /* Types */
+    /**
+     * @class Reservation
+     *
+     * @brief Scoped reservation. Releases its space on destruction unless
+     *        commit() was called after the transaction was written.
+     */
+    class Reservation {
+    public:
+        Reservation()
+            : _reserver(nullptr),
+              _bytes(0)
+        {}
+
+        Reservation(Reservation&& other) noexcept
+            : _reserver(other._reserver),
+              _bytes(other._bytes)
+        {
+            other._reserver = nullptr;
+            other._bytes = 0;
+        }
+
+        Reservation&
+        operator=(Reservation&& other) noexcept
+        {
+            if (this != &other) {
+                reset();
+                _reserver = other._reserver;
+                _bytes = other._bytes;
+                other._reserver = nullptr;
+                other._bytes = 0;
+            }
+            return *this;
+        }
+
+        Reservation(const Reservation&) = delete;
+        Reservation& operator=(const Reservation&) = delete;
+
+        ~Reservation()
+        {
+            reset();
+        }
+
+        /** @brief Does this object hold reserved space? */
+        explicit operator bool() const
+        {
+            return _reserver != nullptr;
+        }
+
+        /** @brief Bytes held by this reservation. */
+        uint64_t
+        bytes() const
+        {
+            return _bytes;
+        }
+
+        /**
+         * @brief The transaction has been written; its space now belongs to
+         *        the journal and is returned when the tail moves past it.
+         */
+        void
+        commit()
+        {
+            _reserver = nullptr;
+            _bytes = 0;
+        }
+
+        /** @brief Give the reserved space back. */
+        void
+        reset()
+        {
+            if (_reserver != nullptr) {
+                _reserver->release(_bytes);
+                _reserver = nullptr;
+                _bytes = 0;
+            }
+        }
+
+    private:
+        friend class JournalSpaceReserver;
+
+        Reservation(JournalSpaceReserver* reserver, uint64_t bytes)
+            : _reserver(reserver),
+              _bytes(bytes)
+        {}
+
+        JournalSpaceReserver* _reserver;
+        uint64_t _bytes;
+    }; /* class Reservation */
+
+public: /* Constructor */
+    /**
+     * @param[in] capacity  Journal data bytes available when the reserver
+     *                      starts, i.e. JournalLayout::data_capacity() of
+     *                      the unused segments.
+     */
+    explicit JournalSpaceReserver(uint64_t capacity)
+        : _capacity(capacity),
+          _available(capacity)
+    {}
+
+    JournalSpaceReserver(const JournalSpaceReserver&) = delete;
+    JournalSpaceReserver& operator=(const JournalSpaceReserver&) = delete;
+
+public: /* Functions */
+    /**
+     * @brief Reserve space without blocking.
+     *
+     * @param[in] bytes  Space to reserve, normally TransactionFootprint::total_ondisk_size().
+     * @return A held reservation on success, an empty one if the journal
+     *         does not currently have the space.
+     */
+    Reservation
+    try_reserve(uint64_t bytes)
+    {
+        uint64_t available = _available.load(std::memory_order_relaxed);
+        while (available >= bytes) {
+            if (_available.compare_exchange_weak(available, available - bytes,
+                                                 std::memory_order_acquire,
+                                                 std::memory_order_relaxed)) {
+                return Reservation(this, bytes);
+            }
+        }
+        return Reservation();
+    }
+
+    /**
+     * @brief Reserve space, waiting for release() to free enough of it.
+     *
+     * @param[in] bytes  Space to reserve.
+     * @return A held reservation, or an empty one if @p bytes exceeds the
+     *         capacity of the journal and could never be satisfied.
+     */
+    Reservation
+    reserve(uint64_t bytes)
+    {
+        if (bytes > _capacity) {
+            return Reservation();
+        }
+        Reservation reservation = try_reserve(bytes);
+        if (reservation) {
+            return reservation;
+        }
+        /* Time commits spend blocked on a full journal */
+        U_PROF_SCOPE("journal_space.reserve_blocked");
+        std::unique_lock<std::mutex> lock(_mutex);
+        _waiters.fetch_add(1, std::memory_order_relaxed);
+        /* Pairs with the fence in release(): either it sees this waiter or
+         * the check below sees its space */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        _released.wait(lock, [&] {
+            reservation = try_reserve(bytes);
+            return static_cast<bool>(reservation);
+        });
+        _waiters.fetch_sub(1, std::memory_order_relaxed);
+        return reservation;
+    }
+
+    /**
+     * @brief Return space to the journal.
+     *
+     * @param[in] bytes  Space freed by an abandoned reservation or by the
+     *                   tail advancing over written segments, counted in
+     *                   data-area bytes like the capacity.
+     */
+    void
+    release(uint64_t bytes)
+    {
+        _available.fetch_add(bytes, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_waiters.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        /* Taking the lock orders this release against a waiter's check */
+        U_PROF_LOCK_GUARD(_mutex, "journal_space.mutex");
+        _released.notify_all();
+    }
+
+    /** @brief Bytes not currently reserved. */
+    uint64_t
+    available() const
+    {
+        return _available.load(std::memory_order_relaxed);
+    }
+
+    /** @brief Total journal bytes this reserver hands out. */
+    uint64_t
+    capacity() const
+    {
+        return _capacity;
+    }
+
+private: /* Data members */
+    /** @brief Upper bound on a single reservation. */
+    const uint64_t _capacity;
+
+    /** @brief Bytes not currently reserved or written. */
+    std::atomic<uint64_t> _available;
+
+    /** @brief Threads blocked in reserve(); release() only signals if any. */
+    std::atomic<uint32_t> _waiters{0};
+
+    /** @brief Serializes waiters in reserve() against release(). */
+    std::mutex _mutex;
+
+    /** @brief Signalled whenever space is released. */
+    std::condition_variable _released;
+}; /* class JournalSpaceReserver */
+
+} /* namespace ltf */
+
+#endif /* LTF_JOURNAL_SPACE_H */
@@ -0,0 +1,301 @@
+/* Copyright Hewlett Packard Enterprise Development LP. */
+
+/**
+ * @file ltf_latency_histogram.h
+ * @brief Contains `LatencyHistogram` - a lock-free, sharded, log-linear
+ *        latency histogram - and `DspLatencyStats`, the set of histograms
+ *        kept for each DSP.
+ */
+#ifndef LTF_LATENCY_HISTOGRAM_H
+#define LTF_LATENCY_HISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace ltf {
+
+/**
+ * @brief What a latency histogram measures. Moyo RPCs get one entry each,
+ *        recorded only in the node-wide stats, not in any DSP's.
+ */
+enum class LatencyMetric : uint32_t {
+    Commit,
+    JournalWrite,
+    RecoveryBatch,
+    CopyForward,
+    MoyoLtfTraceRecordEnable,
+    MoyoLtfLatencyHistograms,
+    MoyoLtfFlightRecorderSnapshot,
+    MoyoLtfBackgroundJobs,
+    MoyoLtfBackgroundJobCancel,
+    MoyoLtfContentionProfile,
+    MoyoLtfTraceConfigure,
+    Count
+};
+
+/**
+ * @brief Name of a latency metric, as reported by the ltfLatencyHistograms moyo.
+ */
+inline const char*
+latency_metric_name(LatencyMetric metric)
+{
+    switch (metric) {
+    case LatencyMetric::Commit:                   return "commit";
+    case LatencyMetric::JournalWrite:             return "journal_write";
+    case LatencyMetric::RecoveryBatch:            return "recovery_batch";
+    case LatencyMetric::CopyForward:              return "copy_forward";
+    case LatencyMetric::MoyoLtfTraceRecordEnable: return "moyo.ltfTraceRecordEnable";
+    case LatencyMetric::MoyoLtfLatencyHistograms: return "moyo.ltfLatencyHistograms";
+    case LatencyMetric::MoyoLtfFlightRecorderSnapshot:
+        return "moyo.ltfFlightRecorderSnapshot";
+    case LatencyMetric::MoyoLtfBackgroundJobs:    return "moyo.ltfBackgroundJobs";
+    case LatencyMetric::MoyoLtfBackgroundJobCancel:
+        return "moyo.ltfBackgroundJobCancel";
+    case LatencyMetric::MoyoLtfContentionProfile:
+        return "moyo.ltfContentionProfile";
+    case LatencyMetric::MoyoLtfTraceConfigure:    return "moyo.ltfTraceConfigure";
+    case LatencyMetric::Count:                    break;
+    }
+    return "unknown";
+}
+
+/**
+ * @struct LatencySnapshot
+ *
+ * @brief Merged contents of a LatencyHistogram at one point in time.
+ */
+struct LatencySnapshot {
+    /** @brief Sample count per bucket. */
+    std::vector<uint64_t> buckets;
+
+    /** @brief Number of samples. */
+    uint64_t count = 0;
+
+    /** @brief Sum of all samples, in nanoseconds. */
+    uint64_t sum_ns = 0;
+
+    /** @brief Largest sample, in nanoseconds. */
+    uint64_t max_ns = 0;
+
+    /**
+     * @brief Value at or below which @p percentile percent of the samples lie.
+     *
+     * @param[in] percentile  In the range [0, 100].
+     * @return Upper bound of the bucket holding that sample, in nanoseconds,
+     *         clamped to max_ns; 0 when there are no samples.
+     */
+    uint64_t percentile(double percentile) const;
+};
+
+/**
+ * @class LatencyHistogram
+ *
+ * @brief HDR-style histogram of nanosecond latencies. Values below
+ *        2^SUB_bucket_bits are counted exactly; above that every power of two
+ *        is split into 2^SUB_bucket_bits buckets, giving ~6% relative error.
+ *
+ * Recording is a handful of relaxed atomic adds on a shard picked per thread,
+ * so concurrent recorders on different cores do not share cache lines.
+ * Readers merge the shards; snapshot(true) resets while reading, without
+ * losing samples recorded concurrently.
+ */
+class LatencyHistogram {
+public: /* Constants */
+    /** @brief log2 of the number of buckets per power of two. */
+    static constexpr uint32_t SUB_bucket_bits = 4;
+
+    /** @brief Number of buckets per power of two. */
+    static constexpr uint32_t SUB_bucket_count = 1u << SUB_bucket_bits;
+
+    /** @brief Values at or above 2^MAX_value_bits ns (~18 minutes) share the last bucket. */
+    static constexpr uint32_t MAX_value_bits = 40;
+
+    /** @brief Total number of buckets. */
+    static constexpr uint32_t BUCKET_count =
+        (MAX_value_bits - SUB_bucket_bits + 1) * SUB_bucket_count;
+
+    /** @brief Number of per-thread shards. */
+    static constexpr uint32_t SHARD_count = 8;
+
+public: /* Constructor */
+    LatencyHistogram() = default;
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+public: /* Functions */
+    /**
+     * @brief Record one sample.
+     *
+     * @param[in] ns  Latency in nanoseconds.
+     */
+    void
+    record(uint64_t ns)
+    {
+        Shard& shard = _shards[_shard_index()];
+        shard.buckets[bucket_index(ns)].fetch_add(1, std::memory_order_relaxed);
+        shard.count.fetch_add(1, std::memory_order_relaxed);
+        shard.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t max = shard.max_ns.load(std::memory_order_relaxed);
+        while (ns > max &&
+               !shard.max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    /**
+     * @brief Merge all shards.
+     *
+     * @param[in] reset  Clear the histogram while reading it.
+     */
+    LatencySnapshot
+    snapshot(bool reset)
+    {
+        LatencySnapshot result;
+        result.buckets.assign(BUCKET_count, 0);
+        for (Shard& shard : _shards) {
+            for (uint32_t i = 0; i < BUCKET_count; i++) {
+                result.buckets[i] += _read(shard.buckets[i], reset);
+            }
+            result.count += _read(shard.count, reset);
+            result.sum_ns += _read(shard.sum_ns, reset);
+            const uint64_t max = _read(shard.max_ns, reset);
+            if (max > result.max_ns) {
+                result.max_ns = max;
+            }
+        }
+        return result;
+    }
+
+    /** @brief Bucket a value is counted in. */
+    static uint32_t
+    bucket_index(uint64_t ns)
+    {
+        if (ns < SUB_bucket_count) {
+            return static_cast<uint32_t>(ns);
+        }
+        const uint32_t exponent = 63 - static_cast<uint32_t>(__builtin_clzll(ns));
+        if (exponent >= MAX_value_bits) {
+            return BUCKET_count - 1;
+        }
+        const uint32_t sub = static_cast<uint32_t>(ns >> (exponent - SUB_bucket_bits)) &
+                             (SUB_bucket_count - 1);
+        return (exponent - SUB_bucket_bits + 1) * SUB_bucket_count + sub;
+    }
+
+    /** @brief Largest value counted in a bucket. */
+    static uint64_t
+    bucket_upper_bound(uint32_t index)
+    {
+        if (index < SUB_bucket_count) {
+            return index;
+        }
+        const uint32_t exponent = index / SUB_bucket_count + SUB_bucket_bits - 1;
+        const uint64_t sub = index % SUB_bucket_count;
+        const uint32_t shift = exponent - SUB_bucket_bits;
+        return ((SUB_bucket_count + sub + 1) << shift) - 1;
+    }
+
+private: /* Types */
+    /** @brief One thread group's counters, on their own cache lines. */
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, BUCKET_count> buckets{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum_ns{0};
+        std::atomic<uint64_t> max_ns{0};
+    };
+
+private: /* Helper functions */
+    static uint32_t
+    _shard_index()
+    {
+        static std::atomic<uint32_t> next_shard{0};
+        thread_local const uint32_t shard =
+            next_shard.fetch_add(1, std::memory_order_relaxed) % SHARD_count;
+        return shard;
+    }
+
+    static uint64_t
+    _read(std::atomic<uint64_t>& counter, bool reset)
+    {
+        return reset ? counter.exchange(0, std::memory_order_relaxed)
+                     : counter.load(std::memory_order_relaxed);
+    }
+
+private: /* Data members */
+    /** @brief Per-thread shards; merged by snapshot(). */
+    std::array<Shard, SHARD_count> _shards;
+}; /* class LatencyHistogram */
+
+inline uint64_t
+LatencySnapshot::percentile(double percentile) const
+{
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(count) + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            const uint64_t bound = LatencyHistogram::bucket_upper_bound(i);
+            return bound < max_ns ? bound : max_ns;
+        }
+    }
+    return max_ns;
+}
+
+/**
+ * @class DspLatencyStats
+ *
+ * @brief One LatencyHistogram per LatencyMetric, kept for each DSP.
+ */
+class DspLatencyStats {
+public: /* Functions */
+    /** @brief Histogram for @p metric. */
+    LatencyHistogram&
+    histogram(LatencyMetric metric)
+    {
+        return _histograms[static_cast<uint32_t>(metric)];
+    }
+
+private: /* Data members */
+    std::array<LatencyHistogram, static_cast<uint32_t>(LatencyMetric::Count)> _histograms;
+}; /* class DspLatencyStats */
+
+/**
+ * @class LatencyScope
+ *
+ * @brief Records the lifetime of the scope into a histogram, e.g.
+ *
+ *     LatencyScope scope(stats->histogram(LatencyMetric::Commit));
+ */
+class LatencyScope {
+public:
+    explicit LatencyScope(LatencyHistogram& histogram)
+        : _histogram(histogram),
+          _start(std::chrono::steady_clock::now())
+    {}
+
+    LatencyScope(const LatencyScope&) = delete;
+    LatencyScope& operator=(const LatencyScope&) = delete;
+
+    ~LatencyScope()
+    {
+        const auto elapsed = std::chrono::steady_clock::now() - _start;
+        _histogram.record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+
+private:
+    LatencyHistogram& _histogram;
+    const std::chrono::steady_clock::time_point _start;
+}; /* class LatencyScope */
+
+} /* namespace ltf */
+
+#endif /* LTF_LATENCY_HISTOGRAM_H */
@@ -0,0 +1,662 @@
+/* Copyright Hewlett Packard Enterprise Development LP. */
+
+/**
+ * @file ltf_task_scheduler.h
+ * @brief Contains `TaskScheduler` - a work-stealing executor for moyo
+ *        background jobs such as journal dumps, verification and trace
+ *        recording - and the job, chunk and status types it works with.
+ */
+#ifndef LTF_TASK_SCHEDULER_H
+#define LTF_TASK_SCHEDULER_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "u_prof.h"
+
+namespace ltf {
+
+/**
+ * @brief Priority class of a job. A worker always takes a chunk of the
+ *        highest class available anywhere before any lower class.
+ */
+enum class TaskPriority : uint32_t {
+    /** @brief Work a commit is waiting for; exempt from the budgets. */
+    Foreground,
+    /** @brief Housekeeping, e.g. copy-forward. */
+    Background,
+    /** @brief Moyo diagnostics: dumps, verification, trace recording. */
+    Diagnostic,
+    Count
+};
+
+/**
+ * @brief Name of a priority class, as reported by the ltfBackgroundJobs moyo.
+ */
+inline const char*
+task_priority_name(TaskPriority priority)
+{
+    switch (priority) {
+    case TaskPriority::Foreground: return "foreground";
+    case TaskPriority::Background: return "background";
+    case TaskPriority::Diagnostic: return "diagnostic";
+    case TaskPriority::Count:      break;
+    }
+    return "unknown";
+}
+
+/**
+ * @brief Life cycle of a job.
+ */
+enum class JobState : uint32_t {
+    Running,
+    Done,
+    /** @brief Cancelled before all its chunks ran. */
+    Cancelled,
+    /**
+     * @brief A chunk returned an error or threw; the remaining chunks were
+     *        skipped.
+     */
+    Failed
+};
+
+/**
+ * @brief Name of a job state, as reported by the ltfBackgroundJobs moyo.
+ */
+inline const char*
+job_state_name(JobState state)
+{
+    switch (state) {
+    case JobState::Running:   return "running";
+    case JobState::Done:      return "done";
+    case JobState::Cancelled: return "cancelled";
+    case JobState::Failed:    return "failed";
+    }
+    return "unknown";
+}
+
+/**
+ * @class TaskContext
+ *
+ * @brief Handed to a running chunk. Long chunks poll cancelled() and return
+ *        early once it is set.
+ */
+class TaskContext {
+public:
+    TaskContext(uint64_t job_id, const std::atomic<bool>& cancelled)
+        : _job_id(job_id),
+          _cancelled(cancelled)
+    {}
+
+    uint64_t job_id() const { return _job_id; }
+
+    bool cancelled() const { return _cancelled.load(std::memory_order_relaxed); }
+
+private:
+    const uint64_t _job_id;
+    const std::atomic<bool>& _cancelled;
+};
+
+/**
+ * @struct TaskChunk
+ *
+ * @brief One schedulable piece of a job, e.g. one segment range of one DSP.
+ */
+struct TaskChunk {
+    /**
+     * @brief The work; returns 0 or an errno value, which fails the job. An
+     *        exception fails it too: ENOMEM for std::bad_alloc, the error
+     *        code of a std::system_error, EIO for anything else.
+     */
+    std::function<int(const TaskContext&)> run;
+
+    /** @brief Does disk I/O, so counts against the I/O budget. */
+    bool io = false;
+};
+
+/**
+ * @brief Split [begin, end) into chunks of at most @p chunk_size, each
+ *        running fn(chunk_begin, chunk_end, context).
+ */
+inline std::vector<TaskChunk>
+split_range(uint64_t begin, uint64_t end, uint64_t chunk_size, bool io,
+            const std::function<int(uint64_t, uint64_t, const TaskContext&)>& fn)
+{
+    std::vector<TaskChunk> chunks;
+    chunk_size = std::max<uint64_t>(chunk_size, 1);
+    for (uint64_t b = begin; b < end; b += std::min(chunk_size, end - b)) {
+        const uint64_t e = b + std::min(chunk_size, end - b);
+        chunks.push_back({ [fn, b, e](const TaskContext& context) { return fn(b, e, context); },
+                           io });
+    }
+    return chunks;
+}
+
+/**
+ * @struct JobStatus
+ *
+ * @brief Progress of a job at one point in time.
+ */
+struct JobStatus {
+    uint64_t job_id = 0;
+    std::string name;
+    uint32_t dsp_internal_id = 0;
+    TaskPriority priority = TaskPriority::Diagnostic;
+    JobState state = JobState::Running;
+    uint32_t chunks_total = 0;
+    uint32_t chunks_done = 0;
+    /** @brief Chunks not run because the job was cancelled or failed. */
+    uint32_t chunks_skipped = 0;
+    /** @brief First error a chunk returned, 0 if none. */
+    int error = 0;
+};
+
+/**
+ * @class TaskScheduler
+ *
+ * @brief Runs jobs split into chunks on a fixed set of workers. Each worker
+ *        has a deque per priority class; it runs its own chunks newest
+ *        first and, when it has none, steals the oldest chunks of other
+ *        workers, so one large job spreads over all idle cores.
+ *
+ * Background and Diagnostic chunks together never occupy more than
+ * cpu_budget workers, and those doing I/O never more than io_budget, so
+ * the remaining workers stay free for Foreground chunks. Foreground chunks
+ * are exempt from both budgets.
+ */
+class TaskScheduler {
+public: /* Constants */
+    /** @brief Finished jobs kept for status queries. */
+    static constexpr uint32_t JOB_history = 64;
+
+    /** @brief Concurrent I/O chunks when not configured. */
+    static constexpr uint32_t DEFAULT_io_budget = 4;
+
+    /** @brief DSP internal id of jobs that are not tied to a DSP. */
+    static constexpr uint32_t NODE_dsp_internal_id = 0;
+
+public: /* Constructor */
+    /**
+     * @param[in] worker_count  Number of worker threads, at least 1.
+     * @param[in] cpu_budget    Workers Background and Diagnostic chunks may
+     *                          occupy at once, clamped to [1, worker_count].
+     * @param[in] io_budget     I/O chunks that may run at once, at least 1.
+     */
+    TaskScheduler(uint32_t worker_count, uint32_t cpu_budget, uint32_t io_budget)
+        : _cpu_budget(std::clamp<uint32_t>(cpu_budget, 1, std::max<uint32_t>(worker_count, 1))),
+          _io_budget(std::max<uint32_t>(io_budget, 1))
+    {
+        worker_count = std::max<uint32_t>(worker_count, 1);
+        for (uint32_t i = 0; i < worker_count; i++) {
+            _workers.emplace_back(new Worker());
+        }
+        for (uint32_t i = 0; i < worker_count; i++) {
+            _workers[i]->thread = std::thread([this, i] { _worker_loop(i); });
+        }
+    }
+
+    /** @brief One worker per core; half of them for background work. */
+    TaskScheduler()
+        : TaskScheduler(_default_worker_count(), _default_worker_count() / 2, DEFAULT_io_budget)
+    {}
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    /** @brief Cancels every job still running and waits for the workers. */
+    ~TaskScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_jobs_mutex);
+            for (auto& entry : _active) {
+                entry.second->cancelled.store(true, std::memory_order_relaxed);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(_sleep_mutex);
+            _stopping = true;
+        }
+        _wake.notify_all();
+        for (auto& worker : _workers) {
+            worker->thread.join();
+        }
+    }
+
+public: /* Functions */
+    /**
+     * @brief Queue a job. Called from a worker, its chunks start on that
+     *        worker's deque; otherwise they are spread over all workers.
+     *
+     * @param[in] name             Shown in status reports.
+     * @param[in] dsp_internal_id  DSP the job works on, or NODE_dsp_internal_id.
+     * @param[in] priority         Priority class of every chunk.
+     * @param[in] chunks           The work.
+     * @return Job id, never 0.
+     */
+    uint64_t
+    submit(std::string name, uint32_t dsp_internal_id, TaskPriority priority,
+           std::vector<TaskChunk> chunks)
+    {
+        std::shared_ptr<Job> job(new Job());
+        job->name = std::move(name);
+        job->dsp_internal_id = dsp_internal_id;
+        job->priority = priority;
+        job->chunks_total = static_cast<uint32_t>(chunks.size());
+        job->remaining.store(job->chunks_total, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(_jobs_mutex);
+            job->job_id = ++_last_job_id;
+            _active[job->job_id] = job;
+        }
+        if (chunks.empty()) {
+            _finish(job);
+            return job->job_id;
+        }
+
+        const uint32_t p = static_cast<uint32_t>(priority);
+        const int32_t self = _current_worker();
+        for (TaskChunk& chunk : chunks) {
+            const uint32_t w = self >= 0 ? static_cast<uint32_t>(self)
+                                         : _next_worker.fetch_add(1, std::memory_order_relaxed) %
+                                               _workers.size();
+            // Count first so the counters never drop below the queue contents
+            if (chunk.io) {
+                _pending_io[p].fetch_add(1, std::memory_order_relaxed);
+            }
+            _pending[p].fetch_add(1, std::memory_order_relaxed);
+            U_PROF_LOCK_GUARD(_workers[w]->mutex, "task_scheduler.queue_mutex");
+            _workers[w]->queues[p].push_back({ job, std::move(chunk) });
+        }
+        _notify();
+        return job->job_id;
+    }
+
+    /**
+     * @brief Cancel a job: its queued chunks are skipped and running chunks
+     *        see TaskContext::cancelled().
+     *
+     * @return false if there is no such running job.
+     */
+    bool
+    cancel(uint64_t job_id)
+    {
+        std::lock_guard<std::mutex> lock(_jobs_mutex);
+        auto it = _active.find(job_id);
+        if (it == _active.end()) {
+            return false;
+        }
+        it->second->cancelled.store(true, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief Progress of a running or recently finished job.
+     *
+     * @return false if the job is unknown or has left the history.
+     */
+    bool
+    status(uint64_t job_id, JobStatus* out) const
+    {
+        std::lock_guard<std::mutex> lock(_jobs_mutex);
+        const std::shared_ptr<const Job> job = _find(job_id);
+        if (job == nullptr) {
+            return false;
+        }
+        *out = _status(*job);
+        return true;
+    }
+
+    /** @brief Running jobs, then recently finished ones, oldest first. */
+    std::vector<JobStatus>
+    jobs() const
+    {
+        std::lock_guard<std::mutex> lock(_jobs_mutex);
+        std::vector<JobStatus> result;
+        for (const auto& entry : _active) {
+            result.push_back(_status(*entry.second));
+        }
+        for (const auto& job : _history) {
+            result.push_back(_status(*job));
+        }
+        return result;
+    }
+
+    /**
+     * @brief Wait for a job to finish.
+     *
+     * @return false if the job is unknown or has left the history.
+     */
+    bool
+    wait(uint64_t job_id, JobStatus* out)
+    {
+        std::unique_lock<std::mutex> lock(_jobs_mutex);
+        // Owned here: the job may leave the history while we wait
+        const std::shared_ptr<const Job> job = _find(job_id);
+        if (job == nullptr) {
+            return false;
+        }
+        _job_finished.wait(lock, [job] { return job->state != JobState::Running; });
+        *out = _status(*job);
+        return true;
+    }
+
+    uint32_t worker_count() const { return static_cast<uint32_t>(_workers.size()); }
+
+    uint32_t cpu_budget() const { return _cpu_budget; }
+
+    uint32_t io_budget() const { return _io_budget; }
+
+private: /* Types */
+    static constexpr uint32_t PRIORITY_count = static_cast<uint32_t>(TaskPriority::Count);
+
+    struct Job {
+        uint64_t job_id = 0;
+        std::string name;
+        uint32_t dsp_internal_id = 0;
+        TaskPriority priority = TaskPriority::Diagnostic;
+        uint32_t chunks_total = 0;
+        std::atomic<uint32_t> remaining{0};
+        std::atomic<uint32_t> chunks_done{0};
+        std::atomic<uint32_t> chunks_skipped{0};
+        std::atomic<int> error{0};
+        std::atomic<bool> cancelled{false};
+        /** @brief Guarded by _jobs_mutex. */
+        JobState state = JobState::Running;
+    };
+
+    struct Task {
+        std::shared_ptr<Job> job;
+        TaskChunk chunk;
+        bool holds_cpu = false;
+        bool holds_io = false;
+    };
+
+    /** @brief One worker's deques, on their own cache lines. */
+    struct alignas(64) Worker {
+        std::mutex mutex;
+        std::array<std::deque<Task>, PRIORITY_count> queues;
+        std::thread thread;
+    };
+
+private: /* Helper functions */
+    static uint32_t
+    _default_worker_count()
+    {
+        return std::max(2u, std::thread::hardware_concurrency());
+    }
+
+    /** @brief Index of the calling worker of this scheduler, or -1. */
+    int32_t
+    _current_worker() const
+    {
+        return _tls_scheduler == this ? _tls_worker : -1;
+    }
+
+    static bool
+    _acquire(std::atomic<uint32_t>& in_use, uint32_t budget)
+    {
+        uint32_t n = in_use.load(std::memory_order_relaxed);
+        while (n < budget) {
+            if (in_use.compare_exchange_weak(n, n + 1, std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** @brief Wake sleeping workers after making work runnable. */
+    void
+    _notify()
+    {
+        { std::lock_guard<std::mutex> lock(_sleep_mutex); }
+        _wake.notify_all();
+    }
+
+    /** @brief Could some worker take a chunk now? */
+    bool
+    _has_runnable() const
+    {
+        if (_pending[0].load(std::memory_order_acquire) != 0) {
+            return true;
+        }
+        if (_cpu_in_use.load(std::memory_order_relaxed) >= _cpu_budget) {
+            return false;
+        }
+        const bool io_free = _io_in_use.load(std::memory_order_relaxed) < _io_budget;
+        for (uint32_t p = 1; p < PRIORITY_count; p++) {
+            const uint32_t pending = _pending[p].load(std::memory_order_acquire);
+            const uint32_t pending_io = _pending_io[p].load(std::memory_order_relaxed);
+            if (pending > pending_io || (pending_io != 0 && io_free)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool
+    _idle() const
+    {
+        for (uint32_t p = 0; p < PRIORITY_count; p++) {
+            if (_pending[p].load(std::memory_order_acquire) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Take the best chunk for worker @p self: highest class first,
+     *        own deque newest first, then other deques oldest first.
+     */
+    bool
+    _take(uint32_t self, Task* out)
+    {
+        const uint32_t n = static_cast<uint32_t>(_workers.size());
+        for (uint32_t p = 0; p < PRIORITY_count; p++) {
+            if (_pending[p].load(std::memory_order_acquire) == 0) {
+                continue;
+            }
+            const bool budgeted = p != static_cast<uint32_t>(TaskPriority::Foreground);
+            if (budgeted && !_acquire(_cpu_in_use, _cpu_budget)) {
+                // Every lower class needs a CPU slot too
+                return false;
+            }
+            bool io_full = false;
+            for (uint32_t k = 0; k < n; k++) {
+                Worker& worker = *_workers[(self + k) % n];
+                U_PROF_LOCK_GUARD(worker.mutex, "task_scheduler.queue_mutex");
+                std::deque<Task>& queue = worker.queues[p];
+                for (size_t i = 0; i < queue.size(); i++) {
+                    auto it = k == 0 ? queue.end() - 1 - i : queue.begin() + i;
+                    if (budgeted && it->chunk.io &&
+                        (io_full || !_acquire(_io_in_use, _io_budget))) {
+                        io_full = true;
+                        continue;
+                    }
+                    *out = std::move(*it);
+                    queue.erase(it);
+                    out->holds_cpu = budgeted;
+                    out->holds_io = budgeted && out->chunk.io;
+                    if (out->chunk.io) {
+                        _pending_io[p].fetch_sub(1, std::memory_order_relaxed);
+                    }
+                    _pending[p].fetch_sub(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+            if (budgeted) {
+                _cpu_in_use.fetch_sub(1, std::memory_order_release);
+            }
+        }
+        return false;
+    }
+
+    void
+    _run(Task& task)
+    {
+        Job& job = *task.job;
+        if (job.cancelled.load(std::memory_order_relaxed)) {
+            job.chunks_skipped.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            const int err = _run_chunk(task.chunk, TaskContext(job.job_id, job.cancelled));
+            job.chunks_done.fetch_add(1, std::memory_order_relaxed);
+            if (err != 0) {
+                int expected = 0;
+                job.error.compare_exchange_strong(expected, err, std::memory_order_relaxed);
+                job.cancelled.store(true, std::memory_order_relaxed);
+            }
+        }
+        if (task.holds_io) {
+            _io_in_use.fetch_sub(1, std::memory_order_release);
+        }
+        if (task.holds_cpu) {
+            _cpu_in_use.fetch_sub(1, std::memory_order_release);
+        }
+        if (task.holds_io || task.holds_cpu) {
+            _notify();
+        }
+        if (job.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            _finish(task.job);
+        }
+    }
+
+    /* Run a chunk on a worker thread, where an escaping exception would
+     * terminate the process; see TaskChunk::run for the errors it maps to */
+    static int
+    _run_chunk(const TaskChunk& chunk, const TaskContext& context)
+    {
+        try {
+            return chunk.run(context);
+        } catch (const std::bad_alloc&) {
+            return ENOMEM;
+        } catch (const std::system_error& e) {
+            return e.code().value() != 0 ? e.code().value() : EIO;
+        } catch (...) {
+            return EIO;
+        }
+    }
+
+    void
+    _finish(const std::shared_ptr<Job>& job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_jobs_mutex);
+            if (job->error.load(std::memory_order_relaxed) != 0) {
+                job->state = JobState::Failed;
+            } else if (job->chunks_skipped.load(std::memory_order_relaxed) != 0) {
+                job->state = JobState::Cancelled;
+            } else {
+                job->state = JobState::Done;
+            }
+            _active.erase(job->job_id);
+            _history.push_back(job);
+            if (_history.size() > JOB_history) {
+                _history.pop_front();
+            }
+        }
+        _job_finished.notify_all();
+    }
+
+    void
+    _worker_loop(uint32_t self)
+    {
+        _tls_scheduler = this;
+        _tls_worker = static_cast<int32_t>(self);
+        Task task;
+        for (;;) {
+            if (_take(self, &task)) {
+                _run(task);
+                task = Task();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(_sleep_mutex);
+            if (_stopping && _idle()) {
+                return;
+            }
+            _wake.wait(lock, [this] { return _has_runnable() || (_stopping && _idle()); });
+        }
+    }
+
+    /** @brief Running or remembered job; caller holds _jobs_mutex. */
+    std::shared_ptr<const Job>
+    _find(uint64_t job_id) const
+    {
+        auto it = _active.find(job_id);
+        if (it != _active.end()) {
+            return it->second;
+        }
+        for (const auto& job : _history) {
+            if (job->job_id == job_id) {
+                return job;
+            }
+        }
+        return nullptr;
+    }
+
+    static JobStatus
+    _status(const Job& job)
+    {
+        JobStatus status;
+        status.job_id = job.job_id;
+        status.name = job.name;
+        status.dsp_internal_id = job.dsp_internal_id;
+        status.priority = job.priority;
+        status.state = job.state;
+        status.chunks_total = job.chunks_total;
+        status.chunks_done = job.chunks_done.load(std::memory_order_relaxed);
+        status.chunks_skipped = job.chunks_skipped.load(std::memory_order_relaxed);
+        status.error = job.error.load(std::memory_order_relaxed);
+        return status;
+    }
+
+private: /* Data members */
+    const uint32_t _cpu_budget;
+    const uint32_t _io_budget;
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+
+    /** @brief Next worker an external submit() starts at. */
+    std::atomic<uint32_t> _next_worker{0};
+
+    /** @brief Queued chunks per class, and how many of them do I/O. */
+    std::array<std::atomic<uint32_t>, PRIORITY_count> _pending{};
+    std::array<std::atomic<uint32_t>, PRIORITY_count> _pending_io{};
+
+    /** @brief Budget slots held by running chunks. */
+    alignas(64) std::atomic<uint32_t> _cpu_in_use{0};
+    std::atomic<uint32_t> _io_in_use{0};
+
+    /** @brief Idle workers sleep here until work becomes runnable. */
+    std::mutex _sleep_mutex;
+    std::condition_variable _wake;
+    bool _stopping = false;
+
+    /** @brief Protects the job tables and Job::state. */
+    mutable std::mutex _jobs_mutex;
+    std::condition_variable _job_finished;
+    uint64_t _last_job_id = 0;
+    std::map<uint64_t, std::shared_ptr<Job>> _active;
+    std::deque<std::shared_ptr<Job>> _history;
+
+    static inline thread_local const TaskScheduler* _tls_scheduler = nullptr;
+    static inline thread_local int32_t _tls_worker = -1;
+}; /* class TaskScheduler */
+
+} /* namespace ltf */
+
+#endif /* LTF_TASK_SCHEDULER_H */
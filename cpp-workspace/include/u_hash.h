@@ -0,0 +1,52 @@
+// FNV-1a hashing: 64-bit for buffers and objects, 32-bit for trace labels.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class u_hash {
+private: // Constants
+    static const uint64_t FNV_prime = 1099511628211ULL;
+    static const uint64_t FNV_offset = 14695981039346656037ULL;
+public: // Constants
+    static const uint64_t initial = FNV_offset;
+public: // Methods:
+    // Hash a buffer of a given len.
+    // This function is additive, i.e., can be used like so:
+    //   uint64_t r;
+    //   r = hash(buf1, len1);   // Note: don't pass in an r==0, or else the
+    //                           //       hash of a buf of 0s will be a 0.
+    //                           //       You can pass u_hash::initial.
+    //   r = hash(buf2, len2, r);
+    //   r = hash(buf3, len3, r);
+    //   // etc.
+    //
+    static uint64_t
+    hash(const unsigned char* buf, size_t len, uint64_t r = initial)
+    {
+        while (len > 0) {
+            r ^= (uint64_t)*buf++;
+            r *= FNV_prime;
+            --len;
+        }
+        return r;
+    }
+    // Generalization: allow calls to hash() with objects of any type
+    template <typename T>
+    static uint64_t
+    hash(const T* buf, uint32_t count = 1, uint64_t r = initial)
+    {
+        return hash(reinterpret_cast<const unsigned char*>(buf), sizeof(T) * count, r);
+    }
+
+}; // u_hash
+
+// 32-bit FNV-1a, usable at compile time; hashes trace format strings.
+constexpr uint32_t fnv1a_32(const char* str, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= static_cast<uint32_t>(str[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,165 @@
+// Compile-time perfect hashing for fixed string-to-enum tables.
+//
+// UPerfectHashMap is built by a constexpr search for a hash seed under
+// which no two keys share a slot, so a lookup is one hash, one probe and
+// one string compare, with no heap and no collision chain to walk:
+//
+//   constexpr auto colors = u_make_perfect_hash_map<Color>({
+//       { "red", Color::Red },
+//       { "green", Color::Green },
+//   });
+//   std::optional<Color> c = colors.find(name);
+//
+// Build the map in a constexpr context: a table with duplicate keys, or one
+// for which no seed is found, fails to compile.
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+
+// One key/value pair of a UPerfectHashMap.
+template <typename Enum>
+struct UPerfectHashEntry {
+    std::string_view key;
+    Enum value;
+};
+
+// Not constexpr: reaching one of these while building a map at compile time
+// is a compile error naming the problem.
+inline void u_perfect_hash_error_duplicate_key() {}
+inline void u_perfect_hash_error_no_seed_found() {}
+
+template <typename Enum, size_t N>
+class UPerfectHashMap {
+    static_assert(N > 0, "a perfect hash map needs at least one key");
+
+public: // Constants
+    // Four slots per key keeps the expected seed search short (tens of
+    // tries for a few dozen keys) at a few hundred bytes per table.
+    static constexpr size_t TABLE_size = std::bit_ceil(N * 4);
+    static constexpr uint32_t MAX_seeds = 1u << 16;
+
+public: // Methods
+    consteval explicit UPerfectHashMap(const UPerfectHashEntry<Enum> (&entries)[N]) {
+        for (size_t i = 0; i < N; i++) {
+            _entries[i] = entries[i];
+            for (size_t j = 0; j < i; j++) {
+                if (entries[j].key == entries[i].key) {
+                    u_perfect_hash_error_duplicate_key();
+                }
+            }
+        }
+        for (uint32_t seed = 0; seed < MAX_seeds; seed++) {
+            if (_try_seed(seed)) {
+                return;
+            }
+        }
+        u_perfect_hash_error_no_seed_found();
+    }
+
+    // Value for `key`, or nullopt if the key is not in the table.
+    constexpr std::optional<Enum> find(std::string_view key) const {
+        const Slot& slot = _slots[_slot(key, _seed)];
+        if (slot.used && _entries[slot.index].key == key) {
+            return _entries[slot.index].value;
+        }
+        return std::nullopt;
+    }
+
+    constexpr bool contains(std::string_view key) const { return find(key).has_value(); }
+
+    // Key for `value`, or an empty view if no key maps to it. A linear scan:
+    // reverse lookups are for reporting, not hot paths.
+    constexpr std::string_view name(Enum value) const {
+        for (const UPerfectHashEntry<Enum>& entry : _entries) {
+            if (entry.value == value) {
+                return entry.key;
+            }
+        }
+        return {};
+    }
+
+    constexpr size_t size() const { return N; }
+    constexpr uint32_t seed() const { return _seed; }
+
+    // Entries in declaration order.
+    constexpr const UPerfectHashEntry<Enum>* begin() const { return _entries.data(); }
+    constexpr const UPerfectHashEntry<Enum>* end() const { return _entries.data() + N; }
+
+private: // Types
+    struct Slot {
+        uint16_t index = 0;
+        bool used = false;
+    };
+    static_assert(N <= UINT16_MAX, "slot indices are 16 bits");
+
+private: // Methods
+    // Eight bytes per multiply: byte-at-a-time FNV costs more than the
+    // unordered_map lookups this replaces once keys pass a dozen characters.
+    // Little-endian in both paths, so a lookup hashes a key as the seed
+    // search did on any host.
+    static constexpr uint64_t _load(const char* p, size_t n) {
+        uint64_t word = 0;
+        if (!std::is_constant_evaluated() && n == sizeof(word)) {
+            std::memcpy(&word, p, sizeof(word));
+            if constexpr (std::endian::native == std::endian::big) {
+                word = __builtin_bswap64(word);
+            }
+            return word;
+        }
+        for (size_t i = 0; i < n; i++) {
+            word |= static_cast<uint64_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+        }
+        return word;
+    }
+
+    static constexpr size_t _slot(std::string_view key, uint32_t seed) {
+        constexpr uint64_t MIX = 0x9e3779b97f4a7c15ull;
+        const char* const p = key.data();
+        const size_t len = key.size();
+        uint64_t hash = (seed + 1) * MIX ^ len;
+        size_t i = 0;
+        for (; i + 8 <= len; i += 8) {
+            hash = (hash ^ _load(p + i, 8)) * MIX;
+        }
+        if (i < len) {
+            // Reread the last eight bytes rather than loop over the tail
+            hash = (hash ^ (len >= 8 ? _load(p + len - 8, 8) : _load(p + i, len - i))) * MIX;
+        }
+        // A multiply only carries bits upward, so the top bits are the ones
+        // every key byte reaches
+        return hash >> (64 - std::countr_zero(TABLE_size));
+    }
+
+    constexpr bool _try_seed(uint32_t seed) {
+        _slots = {};
+        for (size_t i = 0; i < N; i++) {
+            Slot& slot = _slots[_slot(_entries[i].key, seed)];
+            if (slot.used) {
+                return false;
+            }
+            slot.index = static_cast<uint16_t>(i);
+            slot.used = true;
+        }
+        _seed = seed;
+        return true;
+    }
+
+private: // Members
+    std::array<UPerfectHashEntry<Enum>, N> _entries{};
+    std::array<Slot, TABLE_size> _slots{};
+    uint32_t _seed = 0;
+};
+
+// Deduces the table size from the initializer list.
+template <typename Enum, size_t N>
+consteval UPerfectHashMap<Enum, N>
+u_make_perfect_hash_map(const UPerfectHashEntry<Enum> (&entries)[N]) {
+    return UPerfectHashMap<Enum, N>(entries);
+}
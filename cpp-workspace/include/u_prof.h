@@ -0,0 +1,393 @@
+// Contention profiler: call count, time and lock wait time per trace site,
+// named lock and named scope, for production use without attaching perf.
+//
+// Sites are registered once (usually as function statics) and get a small
+// index. Each thread counts into its own cache-line aligned block of
+// per-site counters, written only by that thread, so recording is a TSC
+// read and a few uncontended stores. u_prof_snapshot() sums the blocks of
+// all threads on demand; time is kept in ticks and converted then.
+//
+// Off until u_prof_enable(true); a disabled site costs one relaxed load.
+// Build with U_PROF_DISABLED to compile the recording out entirely.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "u_tr_clock.h"
+
+// Most sites that can be registered; later ones are counted under site 0
+constexpr uint32_t U_PROF_MAX_sites = 1024;
+
+// No site: what UProfScope is given when profiling is off
+constexpr uint32_t U_PROF_no_site = UINT32_MAX;
+
+#ifdef U_PROF_DISABLED
+constexpr bool u_prof_compiled_in = false;
+#else
+constexpr bool u_prof_compiled_in = true;
+#endif
+
+enum class UProfKind : uint8_t {
+    TraceSite,
+    Lock,
+    Scope
+};
+
+inline const char *u_prof_kind_name(UProfKind kind) {
+    switch (kind) {
+    case UProfKind::TraceSite: return "trace";
+    case UProfKind::Lock:      return "lock";
+    case UProfKind::Scope:     return "scope";
+    }
+    return "unknown";
+}
+
+inline std::atomic<bool> u_prof_on{false};
+
+inline bool u_prof_enabled() {
+    return u_prof_compiled_in && u_prof_on.load(std::memory_order_relaxed);
+}
+
+inline void u_prof_enable(bool on) {
+    u_prof_on.store(on, std::memory_order_relaxed);
+}
+
+// One site's counters in one thread. Only the owning thread writes them,
+// with plain load + store, so readers never see a torn or lost update.
+struct UProfCounters {
+    std::atomic<uint64_t> calls;
+    // Time inside the site: the call for trace sites and scopes, the time
+    // the lock was held for locks
+    std::atomic<uint64_t> ticks;
+    // Time spent waiting for a lock that was held by another thread
+    std::atomic<uint64_t> wait_ticks;
+    // Acquisitions that had to wait
+    std::atomic<uint64_t> contended;
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+struct alignas(64) UProfThreadCounters {
+    UProfCounters sites[U_PROF_MAX_sites] = {};
+};
+
+// Site names and the per-thread counter blocks
+class UProfRegistry {
+public:
+    UProfRegistry() {
+        _names[0] = "(too many sites)";
+        _kinds[0] = UProfKind::Scope;
+        _count.store(1, std::memory_order_release);
+    }
+
+    // Index of the site (name, kind), registering it on first use.
+    // `copy_name` keeps a copy of a name that may not outlive the call,
+    // as runtime formats and labels may not.
+    uint32_t site(const char *name, UProfKind kind, bool copy_name = false) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const uint32_t count = _count.load(std::memory_order_relaxed);
+        for (uint32_t i = 1; i < count; i++) {
+            if (_kinds[i] == kind && std::strcmp(_names[i], name) == 0) {
+                return i;
+            }
+        }
+        if (count == U_PROF_MAX_sites) {
+            return 0;
+        }
+        _names[count] = copy_name ? _copies.emplace_back(name).c_str() : name;
+        _kinds[count] = kind;
+        _count.store(count + 1, std::memory_order_release);
+        return count;
+    }
+
+    // Site of the trace format with `hash`: one load when already known
+    uint32_t trace_site(uint32_t hash, const char *fmt, bool copy_name = false) {
+        for (uint32_t probe = 0; probe < HASH_probes; probe++) {
+            std::atomic<uint64_t>& slot = _by_hash[(hash + probe) % HASH_slots];
+            const uint64_t entry = slot.load(std::memory_order_acquire);
+            if (entry == 0) {
+                break;
+            }
+            if (static_cast<uint32_t>(entry >> 32) == hash) {
+                return static_cast<uint32_t>(entry);
+            }
+        }
+        const uint32_t index = site(fmt, UProfKind::TraceSite, copy_name);
+        for (uint32_t probe = 0; probe < HASH_probes; probe++) {
+            std::atomic<uint64_t>& slot = _by_hash[(hash + probe) % HASH_slots];
+            uint64_t expected = 0;
+            const uint64_t entry = (static_cast<uint64_t>(hash) << 32) | index;
+            if (slot.compare_exchange_strong(expected, entry, std::memory_order_release) ||
+                static_cast<uint32_t>(expected >> 32) == hash) {
+                break;
+            }
+        }
+        return index;
+    }
+
+    const char *name(uint32_t index) const { return _names[index]; }
+
+    UProfKind kind(uint32_t index) const { return _kinds[index]; }
+
+    uint32_t count() const { return _count.load(std::memory_order_acquire); }
+
+    // Counter block for a new thread: one a finished thread left behind,
+    // whose counts keep adding up, or a new one
+    UProfThreadCounters *acquire() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_free.empty()) {
+            UProfThreadCounters *counters = _free.back();
+            _free.pop_back();
+            return counters;
+        }
+        _threads.push_back(new UProfThreadCounters());
+        return _threads.back();
+    }
+
+    void retire(UProfThreadCounters *counters) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _free.push_back(counters);
+    }
+
+    // Call fn(counters) for every thread's block
+    template <typename Fn>
+    void for_each_thread(Fn&& fn) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const UProfThreadCounters *counters : _threads) {
+            fn(*counters);
+        }
+    }
+
+private:
+    static constexpr uint32_t HASH_slots = 4096;
+    static constexpr uint32_t HASH_probes = 8;
+
+    std::mutex _mutex;
+    std::atomic<uint32_t> _count{0};
+    const char *_names[U_PROF_MAX_sites] = {};
+    UProfKind _kinds[U_PROF_MAX_sites] = {};
+    // (format hash << 32) | site index, for trace_site()
+    std::atomic<uint64_t> _by_hash[HASH_slots] = {};
+    // Names site() copied; a deque never moves its elements
+    std::deque<std::string> _copies;
+    // Blocks are never freed: threads may count into them until they exit
+    std::vector<UProfThreadCounters *> _threads;
+    std::vector<UProfThreadCounters *> _free;
+};
+
+// Never destroyed, so threads exiting late can still retire their blocks
+inline UProfRegistry& u_prof_registry() {
+    static UProfRegistry *registry = new UProfRegistry();
+    return *registry;
+}
+
+// The calling thread's counters for site `index`
+inline UProfCounters& u_prof_counters(uint32_t index) {
+    struct Slot {
+        UProfThreadCounters *counters = nullptr;
+        ~Slot() {
+            if (counters != nullptr) {
+                u_prof_registry().retire(counters);
+            }
+        }
+    };
+    thread_local Slot slot;
+    if (slot.counters == nullptr) {
+        slot.counters = u_prof_registry().acquire();
+    }
+    return slot.counters->sites[index];
+}
+
+// A registered site; declare it static at the site, or use the macros below
+class UProfSite {
+public:
+    UProfSite(const char *name, UProfKind kind)
+        : _index(u_prof_registry().site(name, kind))
+    {}
+
+    // For a `name` that may not outlive the site, see UProfRegistry::site()
+    UProfSite(const char *name, UProfKind kind, bool copy_name)
+        : _index(u_prof_registry().site(name, kind, copy_name))
+    {}
+
+    uint32_t index() const { return _index; }
+
+private:
+    const uint32_t _index;
+};
+
+// Counts a call to a site and the time until the end of the scope
+class UProfScope {
+public:
+    explicit UProfScope(const UProfSite& site)
+        : UProfScope(u_prof_enabled() ? site.index() : U_PROF_no_site)
+    {}
+
+    // `index` is U_PROF_no_site to record nothing
+    explicit UProfScope(uint32_t index)
+        : _index(index),
+          _start(index != U_PROF_no_site ? u_tr_clock.ticks() : 0)
+    {}
+
+    UProfScope(const UProfScope&) = delete;
+    UProfScope& operator=(const UProfScope&) = delete;
+
+    ~UProfScope() {
+        if (_index != U_PROF_no_site) {
+            const uint64_t elapsed = u_tr_clock.ticks() - _start;
+            UProfCounters& c = u_prof_counters(_index);
+            UProfCounters::add(c.calls, 1);
+            UProfCounters::add(c.ticks, elapsed);
+        }
+    }
+
+private:
+    const uint32_t _index;
+    const uint64_t _start;
+};
+
+// std::lock_guard that also counts, for a named lock, how long callers
+// waited for it when it was contended and how long they held it
+template <typename Mutex>
+class UProfLockGuard {
+public:
+    UProfLockGuard(Mutex& mutex, const UProfSite& site)
+        : _mutex(mutex),
+          _index(U_PROF_no_site),
+          _acquired(0),
+          _wait(0),
+          _contended(false)
+    {
+        if (!u_prof_enabled()) {
+            _mutex.lock();
+            return;
+        }
+        _index = site.index();
+        const uint64_t start = u_tr_clock.ticks();
+        if (_mutex.try_lock()) {
+            _acquired = start;
+            return;
+        }
+        _mutex.lock();
+        _acquired = u_tr_clock.ticks();
+        _wait = _acquired - start;
+        _contended = true;
+    }
+
+    UProfLockGuard(const UProfLockGuard&) = delete;
+    UProfLockGuard& operator=(const UProfLockGuard&) = delete;
+
+    ~UProfLockGuard() {
+        if (_index == U_PROF_no_site) {
+            _mutex.unlock();
+            return;
+        }
+        const uint64_t held = u_tr_clock.ticks() - _acquired;
+        _mutex.unlock();
+        UProfCounters& c = u_prof_counters(_index);
+        UProfCounters::add(c.calls, 1);
+        UProfCounters::add(c.ticks, held);
+        if (_contended) {
+            UProfCounters::add(c.wait_ticks, _wait);
+            UProfCounters::add(c.contended, 1);
+        }
+    }
+
+private:
+    Mutex& _mutex;
+    uint32_t _index;
+    uint64_t _acquired;
+    uint64_t _wait;
+    bool _contended;
+};
+
+#define U_PROF_CAT2(a, b) a##b
+#define U_PROF_CAT(a, b) U_PROF_CAT2(a, b)
+
+// Profile the rest of the enclosing scope as `name`
+#define U_PROF_SCOPE(name)                                                         \
+    static const UProfSite U_PROF_CAT(u_prof_site_, __LINE__)(name, UProfKind::Scope); \
+    UProfScope U_PROF_CAT(u_prof_scope_, __LINE__)(U_PROF_CAT(u_prof_site_, __LINE__))
+
+// Lock `mutex` for the rest of the scope, profiled as the lock `name`
+#define U_PROF_LOCK_GUARD(mutex, name)                                            \
+    static const UProfSite U_PROF_CAT(u_prof_site_, __LINE__)(name, UProfKind::Lock); \
+    UProfLockGuard<std::remove_reference_t<decltype(mutex)>> U_PROF_CAT(u_prof_lock_, __LINE__)( \
+        mutex, U_PROF_CAT(u_prof_site_, __LINE__))
+
+// --- Reporting ---
+
+struct UProfStats {
+    std::string name;
+    UProfKind kind;
+    uint64_t calls = 0;
+    uint64_t total_ns = 0;
+    uint64_t wait_ns = 0;
+    uint64_t contended = 0;
+
+    // What sorting by cost orders by: time in the site plus time waiting
+    uint64_t cost_ns() const { return total_ns + wait_ns; }
+};
+
+enum class UProfSortKey : uint8_t {
+    Cost,
+    Wait,
+    Calls,
+    Contended
+};
+
+// Totals of every site that was hit, summed over all threads
+inline std::vector<UProfStats> u_prof_snapshot() {
+    UProfRegistry& registry = u_prof_registry();
+    const uint32_t count = registry.count();
+    std::vector<UProfStats> stats(count);
+    std::vector<uint64_t> ticks(count), wait_ticks(count);
+    registry.for_each_thread([&](const UProfThreadCounters& counters) {
+        for (uint32_t i = 0; i < count; i++) {
+            const UProfCounters& c = counters.sites[i];
+            stats[i].calls += c.calls.load(std::memory_order_relaxed);
+            stats[i].contended += c.contended.load(std::memory_order_relaxed);
+            ticks[i] += c.ticks.load(std::memory_order_relaxed);
+            wait_ticks[i] += c.wait_ticks.load(std::memory_order_relaxed);
+        }
+    });
+
+    const double ns_per_tick = u_tr_clock.calibration().ns_per_tick;
+    std::vector<UProfStats> result;
+    for (uint32_t i = 0; i < count; i++) {
+        if (stats[i].calls == 0) {
+            continue;
+        }
+        stats[i].name = registry.name(i);
+        stats[i].kind = registry.kind(i);
+        stats[i].total_ns = static_cast<uint64_t>(static_cast<double>(ticks[i]) * ns_per_tick);
+        stats[i].wait_ns = static_cast<uint64_t>(static_cast<double>(wait_ticks[i]) * ns_per_tick);
+        result.push_back(std::move(stats[i]));
+    }
+    return result;
+}
+
+// Most expensive first
+inline void u_prof_sort(std::vector<UProfStats>& stats, UProfSortKey key) {
+    auto value = [key](const UProfStats& s) {
+        switch (key) {
+        case UProfSortKey::Wait:      return s.wait_ns;
+        case UProfSortKey::Calls:     return s.calls;
+        case UProfSortKey::Contended: return s.contended;
+        case UProfSortKey::Cost:      break;
+        }
+        return s.cost_ns();
+    };
+    std::stable_sort(stats.begin(), stats.end(),
+                     [&](const UProfStats& a, const UProfStats& b) { return value(a) > value(b); });
+}
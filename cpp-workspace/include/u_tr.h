@@ -0,0 +1,209 @@
+// Trace front end: compile-time hashed format labels and the u_tr() call.
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <atomic>
+#include <cstdio>
+#include <optional>
+#include <array>
+#include <type_traits>
+#include <utility>
+
+#include "u_hash.h"
+#include "u_prof.h"
+#include "u_tr_format.h"
+#include "u_tr_level.h"
+#include "u_tr_ring.h"
+
+template <size_t N>
+constexpr uint32_t compute_fnv_hash_of_label(const char (&str)[N]) {
+    return fnv1a_32(str, N - 1); // Exclude null terminator
+}
+
+// Registry of compile-time hashes and their original strings
+struct HashEntry {
+    uint32_t hash;
+    const char* str;
+};
+
+// Build registry with known string literals (expand as needed)
+constexpr std::array<HashEntry, 2> HASH_REGISTRY = {{
+    { compute_fnv_hash_of_label("My log message %d"), "My log message %d" },
+    { compute_fnv_hash_of_label("NK: 66 [Thread %s] Processing removal "), "NK: 66 [Thread %s] Processing removal " },
+}};
+
+// Unhash function: given a hash, return the original string literal (or nullptr if not found)
+constexpr std::optional<const char*> unhash(uint32_t hash) {
+    for (const auto& entry : HASH_REGISTRY) {
+        if (entry.hash == hash) {
+            return entry.str;
+        }
+    }
+    return std::nullopt;
+}
+
+struct UTtr {
+    int msg_limit;
+    double time_interval;
+    const char *label;
+    uint32_t format_hash;
+    std::atomic<int> n;
+    // Profile of this trace site, see u_prof.h
+    UProfSite site;
+    // ... stopwatch and other members ...
+
+    // Templated constructor for string literals
+    template <size_t N>
+    UTtr(int msg_limit, double in_time_interval, const char (&label)[N])
+        : msg_limit(msg_limit),
+          time_interval(in_time_interval),
+          label(label),
+          format_hash(compute_fnv_hash_of_label(label)),
+          n(0),
+          site(label, UProfKind::TraceSite)
+    {}
+
+    // Fallback for runtime strings
+    UTtr(int msg_limit, double in_time_interval, const char *label)
+        : msg_limit(msg_limit),
+          time_interval(in_time_interval),
+          label(label),
+          format_hash(label ? fnv1a_32(label, strlen(label)) : 0),
+          n(0),
+          site(label ? label : "(null)", UProfKind::TraceSite, true)
+    {}
+};
+
+// Module the function-style u_tr() traces under; its runtime threshold
+// is checked before any formatting. Use u_tr_mod() for sites that must
+// compile out entirely.
+constexpr int U_TR_MODULE_default = 0;
+
+// Where formatted trace lines go; defaults to stdout
+inline FILE *u_tr_stream = stdout;
+
+// Binary trace records from literal-format u_tr() calls
+inline UTrRing u_tr_ring(1 << 16);
+
+// Ring u_tr() writes to: u_tr_ring, or the flight recorder's ring once one
+// is open (see u_tr_recorder.h). A ring stays valid once installed here.
+inline std::atomic<UTrRing *> u_tr_active_ring{&u_tr_ring};
+
+// --- u_tr implementation ---
+// Internal implementation for pointer/runtime formats. The site is keyed on
+// the format's hash, not on Args, so runtime formats that take the same
+// argument types are still profiled apart. The hash is only computed while
+// profiling; the line carries the formatted text, so it does not print it.
+template <typename... Args>
+void u_tr_impl_ptr(int level, const char *fmt, Args&&... args) {
+    UProfScope prof(u_prof_enabled() && fmt != nullptr
+                        ? u_prof_registry().trace_site(fnv1a_32(fmt, std::strlen(fmt)), fmt, true)
+                        : U_PROF_no_site);
+
+    char buf[1024];
+    int n = std::snprintf(buf, sizeof(buf), fmt, std::forward<Args>(args)...);
+    if (n < 0) {
+        std::fprintf(stderr, "format error\n");
+        return;
+    }
+    std::fprintf(u_tr_stream, "raghu [L%d] %s\n", level, buf);
+}
+
+// Serialize one literal-format trace of `module` into the active ring,
+// without checking any gate; use u_tr() or u_tr_mod().
+template <typename... Args>
+void u_tr_write(int module, int level, UTrFormat<std::type_identity_t<Args>...> fmt,
+                Args&&... args) {
+    UProfScope prof(u_prof_enabled() ? u_prof_registry().trace_site(fmt.hash, fmt.fmt)
+                                     : U_PROF_no_site);
+    u_tr_format_registry().note(fmt.hash, fmt.fmt);
+    unsigned char payload[UTrRing::MAX_payload];
+    const size_t size = u_tr_serialize(payload, args...);
+    u_tr_active_ring.load(std::memory_order_acquire)
+        ->write(fmt.hash, static_cast<uint16_t>(module), static_cast<uint8_t>(level),
+                u_tr_clock.stamp(), payload, size);
+}
+
+// Literal formats: checked against the argument types at compile time,
+// serialized into the active ring without formatting. u_tr_drain() prints
+// them. Only the runtime gates apply; use u_tr_mod() for sites that must
+// compile out entirely.
+template <typename... Args>
+void u_tr(int level, UTrFormat<std::type_identity_t<Args>...> fmt, Args&&... args) {
+    if (!u_tr_enabled(U_TR_MODULE_default, level) || !u_tr_sampled(U_TR_MODULE_default, level)) {
+        return;
+    }
+    u_tr_write(U_TR_MODULE_default, level, fmt, std::forward<Args>(args)...);
+}
+
+// Trace a literal format under `module`, behind every gate of U_TR_GATED:
+// sites compiled out by U_TR_MIN_LEVEL or U_TR_DISABLED_MODULES generate no
+// code and never evaluate their arguments.
+#define u_tr_mod(module, level, fmt, ...)                               \
+    U_TR_GATED((module), (level), u_tr_write((module), (level), fmt, ## __VA_ARGS__))
+
+// Runtime formats: cannot be checked, so they are formatted with snprintf
+// into u_tr_stream as before.
+template <typename Fmt, typename... Args>
+    requires (!std::is_array_v<std::remove_reference_t<Fmt>>)
+void u_tr(int level, Fmt&& fmt, Args&&... args) {
+    if (!u_tr_enabled(U_TR_MODULE_default, level) || !u_tr_sampled(U_TR_MODULE_default, level)) {
+        return;
+    }
+    u_tr_impl_ptr(level, std::forward<Fmt>(fmt), std::forward<Args>(args)...);
+}
+
+// Wall time of a stamp as "seconds.nanoseconds" since the Unix epoch, or
+// "?" if u_tr_clock has no base for its epoch.
+inline void u_tr_format_time(UTrStamp stamp, char *out, size_t size) {
+    uint64_t ticks;
+    if (!u_tr_clock.ticks_of(stamp, &ticks)) {
+        std::snprintf(out, size, "?");
+        return;
+    }
+    const int64_t ns = u_tr_clock.realtime_ns(ticks);
+    std::snprintf(out, size, "%lld.%09lld", static_cast<long long>(ns / 1000000000),
+                  static_cast<long long>(ns % 1000000000));
+}
+
+// Print one decoded record; `text` is nullptr if its format is unknown.
+inline void u_tr_print_record(FILE *out, const char *when, const UTrRecord& record,
+                              const char *text) {
+    if (text == nullptr) {
+        std::fprintf(out, "%s [L%d][hash=%u] <unknown format>\n", when, record.level,
+                     record.format_hash);
+    } else {
+        std::fprintf(out, "%s [L%d][hash=%u] %s\n", when, record.level, record.format_hash,
+                     text);
+    }
+}
+
+// Print the records written to `ring` since *cursor to `out` and advance
+// *cursor. Stops at a record still being written. Returns the number of
+// records that were overwritten before they could be printed.
+inline uint64_t u_tr_drain(UTrRing& ring, FILE *out, uint64_t *cursor) {
+    const uint64_t head = ring.head();
+    uint64_t lost = 0;
+    if (head - *cursor > ring.capacity()) {
+        lost = head - ring.capacity() - *cursor;
+        *cursor = head - ring.capacity();
+    }
+    UTrRecord record;
+    char text[1024];
+    char when[32];
+    for (; *cursor < head; ++*cursor) {
+        if (!ring.read(*cursor, &record)) {
+            if (ring.head() - *cursor > ring.capacity()) {
+                lost++;
+                continue;
+            }
+            break;
+        }
+        u_tr_format_time(record.stamp(), when, sizeof(when));
+        u_tr_print_record(out, when, record,
+                          u_tr_decode(record, text, sizeof(text)) < 0 ? nullptr : text);
+    }
+    return lost;
+}
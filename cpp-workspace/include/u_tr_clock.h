@@ -0,0 +1,309 @@
+// Trace timestamps: the invariant TSC, calibrated against CLOCK_MONOTONIC
+// and CLOCK_REALTIME, stored compactly in each record.
+//
+// A record holds a 32-bit tick delta from a base and the 16-bit epoch that
+// names the base. The current base moves forward (a new epoch) only when a
+// delta would overflow, i.e. about once a second of wall time at most, so
+// stamping a record is one TSC read and one atomic load. Bases are kept in
+// a table the decoder uses to turn (epoch, delta) back into wall time; it
+// has a slot for every epoch, so a base is only replaced once the 16-bit
+// epoch wraps, after 65535 rebases (hours of wall time).
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define U_TR_HAVE_TSC 1
+#else
+#define U_TR_HAVE_TSC 0
+#endif
+
+struct UTrStamp {
+    uint16_t epoch;
+    uint32_t delta;
+};
+
+class UTrClock {
+public:
+    // Bases kept for decoding: one per epoch, so no two live epochs share
+    // a slot
+    static constexpr uint32_t EPOCH_history = 1u << 16;
+
+    // Maps ticks to clock time: ns = clock_ns0 + (ticks - ticks0) * ns_per_tick
+    struct Calibration {
+        uint64_t ticks0 = 0;
+        int64_t monotonic_ns0 = 0;
+        int64_t realtime_ns0 = 0;
+        double ns_per_tick = 1.0;
+    };
+
+    // Told about every new calibration and base, e.g. to mirror them into a
+    // flight recorder file. Called on the stamping or calibrating thread;
+    // keep it short.
+    struct Listener {
+        virtual void on_calibrate(const Calibration& calibration) = 0;
+        virtual void on_rebase(uint16_t epoch, uint64_t base_ticks) = 0;
+    protected:
+        ~Listener() = default;
+    };
+
+    // Window of the calibration the first reader runs if nobody called
+    // calibrate() yet
+    static constexpr int64_t LAZY_window_ns = 1000000;
+
+    // Does not calibrate: the global clock is built during static
+    // initialization, which should not spin for a millisecond.
+    UTrClock()
+        : _use_tsc(_tsc_is_invariant()),
+          _current(0),
+          _bases(new Base[EPOCH_history])
+    {
+        for (uint32_t i = 0; i < EPOCH_history; i++) {
+            _bases[i].epoch.store(UINT32_MAX, std::memory_order_relaxed);
+        }
+    }
+
+    // Raw tick counter: the TSC when it is invariant, else CLOCK_MONOTONIC ns
+    uint64_t ticks() const {
+#if U_TR_HAVE_TSC
+        if (_use_tsc) {
+            return __rdtsc();
+        }
+#endif
+        return static_cast<uint64_t>(_clock_ns(CLOCK_MONOTONIC));
+    }
+
+    // Measure the tick rate against CLOCK_MONOTONIC over `window_ns` and pin
+    // both clocks to a common instant. Call when recording starts; records
+    // stamped before the call decode with the new calibration. Safe to run
+    // on any thread while others decode: the result is published under a
+    // seqlock, and concurrent calls are serialized.
+    void calibrate(int64_t window_ns = 10000000) {
+        std::lock_guard<std::mutex> lock(_calibrate_mutex);
+        _calibrate_locked(window_ns);
+    }
+
+    // Stamp for the current instant
+    UTrStamp stamp() {
+        const uint64_t now = ticks();
+        uint64_t cur = _current.load(std::memory_order_acquire);
+        for (;;) {
+            const uint64_t base = cur & ~EPOCH_mask;
+            const uint16_t epoch = static_cast<uint16_t>(cur & EPOCH_mask);
+            if (now < base) {
+                // Another thread moved the base past the tick we read;
+                // the error is bounded by that race window.
+                return { epoch, 0 };
+            }
+            if (now - base <= UINT32_MAX) {
+                return { epoch, static_cast<uint32_t>(now - base) };
+            }
+            // Epoch 0 is reserved for "base 0", so wrap around to 1
+            const uint16_t next_epoch = static_cast<uint16_t>(epoch == EPOCH_mask ? 1 : epoch + 1);
+            const uint64_t next = (now & ~EPOCH_mask) | next_epoch;
+            if (_current.compare_exchange_weak(cur, next, std::memory_order_acq_rel)) {
+                Base& b = _bases[next_epoch];
+                b.ticks.store(now & ~EPOCH_mask, std::memory_order_relaxed);
+                b.epoch.store(next_epoch, std::memory_order_release);
+                if (Listener *l = _listener.load(std::memory_order_acquire)) {
+                    l->on_rebase(next_epoch, now & ~EPOCH_mask);
+                }
+                return { next_epoch, static_cast<uint32_t>(now - (now & ~EPOCH_mask)) };
+            }
+        }
+    }
+
+    // Ticks a stamp was taken at. False if its epoch has no base yet.
+    bool ticks_of(UTrStamp stamp, uint64_t *out) const {
+        if (stamp.epoch == 0) {
+            // Epoch 0 starts at tick 0; it lasts until the first rebase
+            *out = stamp.delta;
+            return true;
+        }
+        const Base& b = _bases[stamp.epoch];
+        if (b.epoch.load(std::memory_order_acquire) != stamp.epoch) {
+            return false;
+        }
+        *out = b.ticks.load(std::memory_order_relaxed) + stamp.delta;
+        return true;
+    }
+
+    int64_t monotonic_ns(uint64_t ticks) {
+        const Calibration c = calibration();
+        return c.monotonic_ns0 + _elapsed_ns(c, ticks);
+    }
+
+    int64_t realtime_ns(uint64_t ticks) {
+        const Calibration c = calibration();
+        return c.realtime_ns0 + _elapsed_ns(c, ticks);
+    }
+
+    bool uses_tsc() const { return _use_tsc; }
+
+    // The latest calibration; the first call without one calibrates over
+    // LAZY_window_ns
+    Calibration calibration() {
+        if (_calibration_seq.load(std::memory_order_acquire) == 0) {
+            std::lock_guard<std::mutex> lock(_calibrate_mutex);
+            if (_calibration_seq.load(std::memory_order_relaxed) == 0) {
+                _calibrate_locked(LAZY_window_ns);
+            }
+        }
+        for (;;) {
+            const uint32_t seq = _calibration_seq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                continue;
+            }
+            const Calibration c = _load_calibration();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (_calibration_seq.load(std::memory_order_relaxed) == seq) {
+                return c;
+            }
+        }
+    }
+
+    // Call fn(epoch, base_ticks) for each base in the history
+    template <typename Fn>
+    void for_each_base(Fn&& fn) const {
+        for (uint32_t i = 0; i < EPOCH_history; i++) {
+            const Base& b = _bases[i];
+            const uint32_t epoch = b.epoch.load(std::memory_order_acquire);
+            if (epoch != UINT32_MAX) {
+                fn(static_cast<uint16_t>(epoch), b.ticks.load(std::memory_order_relaxed));
+            }
+        }
+    }
+
+    // Install (or with nullptr remove) the listener and hand it the current
+    // calibration, if any, ordered against calibrate() so it cannot miss or
+    // overwrite a newer one. The previous listener may still be running an
+    // on_rebase() callback when this returns.
+    void set_listener(Listener *listener) {
+        std::lock_guard<std::mutex> lock(_calibrate_mutex);
+        _listener.store(listener, std::memory_order_release);
+        if (listener != nullptr && _calibration_seq.load(std::memory_order_relaxed) != 0) {
+            listener->on_calibrate(_load_calibration());
+        }
+    }
+
+private:
+    static constexpr uint64_t EPOCH_mask = 0xffff;
+    static_assert(EPOCH_history == EPOCH_mask + 1);
+
+    struct Base {
+        std::atomic<uint64_t> ticks{0};
+        std::atomic<uint32_t> epoch{0};
+    };
+
+    // Calibration fields as atomics, so seqlock readers racing a writer
+    // read torn values they then discard rather than undefined ones
+    struct PublishedCalibration {
+        std::atomic<uint64_t> ticks0{0};
+        std::atomic<int64_t> monotonic_ns0{0};
+        std::atomic<int64_t> realtime_ns0{0};
+        std::atomic<double> ns_per_tick{1.0};
+    };
+
+    static int64_t _clock_ns(clockid_t clock) {
+        timespec ts;
+        clock_gettime(clock, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    static bool _tsc_is_invariant() {
+#if U_TR_HAVE_TSC
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+            return (edx & (1u << 8)) != 0;
+        }
+#endif
+        return false;
+    }
+
+    // Read the ticks and both clocks as close together as possible: keep the
+    // sample whose tick reads bracket the clock reads most tightly.
+    void _sample(uint64_t *ticks_out, int64_t *mono, int64_t *real) const {
+        uint64_t best = UINT64_MAX;
+        for (int i = 0; i < 5; i++) {
+            const uint64_t a = ticks();
+            const int64_t m = _clock_ns(CLOCK_MONOTONIC);
+            const int64_t r = _clock_ns(CLOCK_REALTIME);
+            const uint64_t b = ticks();
+            if (b - a < best) {
+                best = b - a;
+                *ticks_out = a + (b - a) / 2;
+                *mono = m;
+                *real = r;
+            }
+        }
+    }
+
+    void _calibrate_locked(int64_t window_ns) {
+        uint64_t t0 = 0;
+        int64_t mono0 = 0, real0 = 0;
+        _sample(&t0, &mono0, &real0);
+        int64_t mono1;
+        uint64_t t1;
+        do {
+            t1 = ticks();
+            mono1 = _clock_ns(CLOCK_MONOTONIC);
+        } while (mono1 - mono0 < window_ns);
+
+        Calibration c;
+        c.ticks0 = t0;
+        c.monotonic_ns0 = mono0;
+        c.realtime_ns0 = real0;
+        c.ns_per_tick = t1 > t0 ? static_cast<double>(mono1 - mono0) / static_cast<double>(t1 - t0)
+                                : 1.0;
+        _publish(c);
+        if (Listener *l = _listener.load(std::memory_order_acquire)) {
+            l->on_calibrate(c);
+        }
+    }
+
+    // Seqlock writer; called with _calibrate_mutex held
+    void _publish(const Calibration& c) {
+        const uint32_t seq = _calibration_seq.load(std::memory_order_relaxed);
+        _calibration_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        _calibration.ticks0.store(c.ticks0, std::memory_order_relaxed);
+        _calibration.monotonic_ns0.store(c.monotonic_ns0, std::memory_order_relaxed);
+        _calibration.realtime_ns0.store(c.realtime_ns0, std::memory_order_relaxed);
+        _calibration.ns_per_tick.store(c.ns_per_tick, std::memory_order_relaxed);
+        _calibration_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // Unchecked read: retry it under the seqlock, or hold _calibrate_mutex
+    Calibration _load_calibration() const {
+        Calibration c;
+        c.ticks0 = _calibration.ticks0.load(std::memory_order_relaxed);
+        c.monotonic_ns0 = _calibration.monotonic_ns0.load(std::memory_order_relaxed);
+        c.realtime_ns0 = _calibration.realtime_ns0.load(std::memory_order_relaxed);
+        c.ns_per_tick = _calibration.ns_per_tick.load(std::memory_order_relaxed);
+        return c;
+    }
+
+    static int64_t _elapsed_ns(const Calibration& c, uint64_t ticks) {
+        const double d = static_cast<double>(static_cast<int64_t>(ticks - c.ticks0));
+        return static_cast<int64_t>(d * c.ns_per_tick);
+    }
+
+    const bool _use_tsc;
+    // Even when stable, odd while calibrate() writes; 0 until the first
+    std::atomic<uint32_t> _calibration_seq{0};
+    PublishedCalibration _calibration;
+    std::mutex _calibrate_mutex;
+    std::atomic<Listener *> _listener{nullptr};
+    alignas(64) std::atomic<uint64_t> _current;
+    // Indexed by epoch; on the heap, as clocks may live on a stack
+    const std::unique_ptr<Base[]> _bases;
+};
+
+// Clock every trace record is stamped with
+inline UTrClock u_tr_clock;
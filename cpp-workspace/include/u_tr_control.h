@@ -0,0 +1,491 @@
+// Live trace control: per-module levels and T_dbg sampling, and where u_tr()
+// records go, changed at run time; plus backpressure that throttles T_dbg
+// traces while the sink cannot keep up.
+//
+// u_tr() always writes binary records into the active ring (u_tr.h). The
+// sink is what happens to them from there:
+//   Ring      they stay in memory, for u_tr_snapshot() or a debugger
+//   File      a drain thread prints them to a file with u_tr_drain()
+//   Recorder  the ring lives in the flight recorder file (u_tr_recorder.h)
+// Runtime-format traces are not recorded and still go to u_tr_stream.
+//
+// UTrControl::configure() applies a UTrConfig all or nothing: the request
+// is validated and the new sink opened before any level, sample period or
+// sink changes, so a request that fails leaves tracing as it was.
+// Configurations are serialized and each one bumps the generation.
+//
+// Sink files are named relative to the control's trace directory. A name
+// that is absolute or has a ".." component is refused with EINVAL, so a
+// remote configure cannot create or append to files anywhere else.
+//
+// While the File sink drains, UTrBackpressure looks at every pass: records
+// lost because the drain fell a whole ring behind, the backlog the pass
+// left, and how long flushing the file took (page cache writeback stalls
+// writers once the disk falls behind). Any of them over its limit doubles
+// the T_dbg sample period of every module; RECOVER_passes calm passes in a
+// row halve it again. Each step is counted, kept with its reason, and
+// traced at T_warn.
+//
+// POSIX only, like the flight recorder.
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <sstream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "u_tr.h"
+#include "u_tr_level.h"
+#include "u_tr_recorder.h"
+
+enum class UTrSinkKind : uint8_t {
+    Ring,
+    File,
+    Recorder
+};
+
+inline const char *u_tr_sink_kind_name(UTrSinkKind kind) {
+    switch (kind) {
+    case UTrSinkKind::Ring:     return "ring";
+    case UTrSinkKind::File:     return "file";
+    case UTrSinkKind::Recorder: return "recorder";
+    }
+    return "unknown";
+}
+
+// Why the throttle last moved
+enum class UTrThrottleReason : uint8_t {
+    None,
+    RecordsLost,
+    Backlog,
+    WriteLatency,
+    Recovered
+};
+
+inline const char *u_tr_throttle_reason_name(UTrThrottleReason reason) {
+    switch (reason) {
+    case UTrThrottleReason::None:         return "none";
+    case UTrThrottleReason::RecordsLost:  return "records_lost";
+    case UTrThrottleReason::Backlog:      return "backlog";
+    case UTrThrottleReason::WriteLatency: return "write_latency";
+    case UTrThrottleReason::Recovered:    return "recovered";
+    }
+    return "unknown";
+}
+
+// One module's part of a UTrConfig
+struct UTrModuleConfig {
+    int module = 0;
+    // New threshold (T_dbg..T_error), or -1 to leave it
+    int level = -1;
+    // New T_dbg sample period, see u_tr_set_debug_sample_period(); 0 leaves it
+    uint32_t debug_sample_period = 0;
+};
+
+struct UTrConfig {
+    std::vector<UTrModuleConfig> modules;
+    // New sink, or nullopt to keep the current one
+    std::optional<UTrSinkKind> sink;
+    // File for the File sink, or recorder file for the Recorder sink,
+    // relative to the trace directory. A process has one recorder: once it
+    // is open, pass an empty path to return to it.
+    std::string sink_path;
+    // Turn backpressure on or off, or nullopt to leave it
+    std::optional<bool> adaptive;
+};
+
+// What one drain pass of the File sink saw
+struct UTrDrainPass {
+    uint64_t records = 0;   // printed
+    uint64_t lost = 0;      // overwritten before they could be printed
+    uint64_t backlog = 0;   // written to the ring during the pass, still unprinted
+    uint64_t capacity = 0;  // of the ring
+    uint64_t write_ns = 0;  // flushing the file
+};
+
+// Decides the T_dbg throttle from drain passes. Only the drain thread
+// calls observe(); the accessors may be called from anywhere.
+class UTrBackpressure {
+public: // Constants
+    static constexpr uint64_t MAX_write_ns = 20'000'000;
+    static constexpr uint32_t RECOVER_passes = 50;
+    // Throttle at most to 1 in 1024 T_dbg traces
+    static constexpr int MAX_throttle = 10;
+
+public:
+    // Feed one pass; returns the throttle shift to apply from now on.
+    int observe(const UTrDrainPass& pass) {
+        UTrThrottleReason reason = UTrThrottleReason::None;
+        if (pass.lost > 0) {
+            reason = UTrThrottleReason::RecordsLost;
+        } else if (pass.backlog > pass.capacity / 4 * 3) {
+            reason = UTrThrottleReason::Backlog;
+        } else if (pass.write_ns > MAX_write_ns) {
+            reason = UTrThrottleReason::WriteLatency;
+        }
+
+        int shift = _shift.load(std::memory_order_relaxed);
+        if (reason != UTrThrottleReason::None) {
+            _calm = 0;
+            if (shift < MAX_throttle) {
+                _step(shift + 1, reason);
+            }
+        } else if (pass.backlog > pass.capacity / 4 || pass.write_ns > MAX_write_ns / 2) {
+            // Under the limits but not clear of them: hold
+            _calm = 0;
+        } else if (shift > 0 && ++_calm >= RECOVER_passes) {
+            _calm = 0;
+            _step(shift - 1, UTrThrottleReason::Recovered);
+        }
+        return _shift.load(std::memory_order_relaxed);
+    }
+
+    void reset() {
+        _shift.store(0, std::memory_order_relaxed);
+        _calm = 0;
+    }
+
+    int shift() const { return _shift.load(std::memory_order_relaxed); }
+    uint64_t events() const { return _events.load(std::memory_order_relaxed); }
+    UTrThrottleReason reason() const { return _reason.load(std::memory_order_relaxed); }
+
+private:
+    void _step(int shift, UTrThrottleReason reason) {
+        _shift.store(shift, std::memory_order_relaxed);
+        _reason.store(reason, std::memory_order_relaxed);
+        _events.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::atomic<int> _shift{0};
+    uint32_t _calm = 0;
+    std::atomic<uint64_t> _events{0};
+    std::atomic<UTrThrottleReason> _reason{UTrThrottleReason::None};
+};
+
+struct UTrControlStatus {
+    uint64_t generation = 0;
+    UTrSinkKind sink = UTrSinkKind::Ring;
+    std::string sink_path;
+    bool adaptive = true;
+    // T_dbg traces currently kept 1 in this many on top of module periods
+    uint32_t debug_throttle_period = 1;
+    uint64_t throttle_events = 0;
+    UTrThrottleReason throttle_reason = UTrThrottleReason::None;
+    // Totals of the File sink
+    uint64_t records_drained = 0;
+    uint64_t records_lost = 0;
+};
+
+class UTrControl {
+public: // Constants
+    static constexpr std::chrono::milliseconds DEFAULT_drain_interval{10};
+    static constexpr const char *DEFAULT_trace_dir = "/var/log/u_tr";
+
+public:
+    explicit UTrControl(std::chrono::milliseconds drain_interval = DEFAULT_drain_interval,
+                        std::string trace_dir = DEFAULT_trace_dir)
+        : _drain_interval(drain_interval),
+          _trace_dir(std::move(trace_dir))
+    {}
+
+    UTrControl(const UTrControl&) = delete;
+    UTrControl& operator=(const UTrControl&) = delete;
+
+    ~UTrControl() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _close_file();
+    }
+
+    // Directory sink paths are relative to. Sinks already open keep their
+    // files.
+    void set_trace_dir(const std::string& trace_dir) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _trace_dir = trace_dir;
+    }
+
+    std::string trace_dir() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _trace_dir;
+    }
+
+    // Resolve `name` against the trace directory as sink paths are, for
+    // other files written on request such as snapshots. False if `name` is
+    // empty, absolute or has a ".." component.
+    bool trace_file_path(const std::string& name, std::string *out) const {
+        if (name.empty() || !_valid_sink_path(name)) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        *out = _in_trace_dir(name);
+        return true;
+    }
+
+    // Returns 0; EINVAL if a module, level or the sink is invalid, or the
+    // sink path is absolute or leaves the trace directory; EALREADY
+    // if the Recorder sink names a file while a recorder is already open;
+    // or the errno value that made opening the sink fail.
+    int configure(const UTrConfig& config) {
+        for (const UTrModuleConfig& m : config.modules) {
+            if (m.module < 0 || m.module >= U_TR_MAX_modules || m.level < -1 || m.level > T_error) {
+                return EINVAL;
+            }
+        }
+
+        if (config.sink && !config.sink_path.empty() && !_valid_sink_path(config.sink_path)) {
+            return EINVAL;
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        // Opening the sink is the last step that can fail
+        FILE *file = nullptr;
+        if (config.sink == UTrSinkKind::File) {
+            if (config.sink_path.empty()) {
+                return EINVAL;
+            }
+            // Not through a symlink someone left in the trace directory
+            const int fd = ::open(_in_trace_dir(config.sink_path).c_str(),
+                                  O_WRONLY | O_APPEND | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                return errno;
+            }
+            file = ::fdopen(fd, "a");
+            if (file == nullptr) {
+                const int err = errno;
+                ::close(fd);
+                return err;
+            }
+        } else if (config.sink == UTrSinkKind::Recorder) {
+            if (config.sink_path.empty()) {
+                std::lock_guard<std::mutex> recorder_lock(u_tr_flight_recorder_mutex);
+                if (u_tr_flight_recorder == nullptr) {
+                    return EINVAL;
+                }
+            } else {
+                // Not activated yet: the ring switches in _switch_sink(),
+                // after everything else in the request has been checked
+                const int err =
+                    u_tr_flight_recorder_create(_in_trace_dir(config.sink_path).c_str());
+                if (err != 0) {
+                    return err;
+                }
+                _recorder_path = config.sink_path;
+            }
+        }
+
+        for (const UTrModuleConfig& m : config.modules) {
+            if (m.level >= 0) {
+                u_tr_set_threshold(m.module, m.level);
+            }
+            if (m.debug_sample_period != 0) {
+                u_tr_set_debug_sample_period(m.module, m.debug_sample_period);
+            }
+        }
+        if (config.sink) {
+            _switch_sink(*config.sink, file, config.sink_path);
+        }
+        if (config.adaptive) {
+            std::lock_guard<std::mutex> drain_lock(_drain_mutex);
+            _adaptive = *config.adaptive;
+            if (!_adaptive) {
+                _backpressure.reset();
+                u_tr_set_debug_throttle(0);
+            }
+        }
+        _generation++;
+        return 0;
+    }
+
+    // One drain pass of the File sink, as the drain thread runs every drain
+    // interval. Returns false if the sink is not File.
+    bool drain_once(UTrDrainPass *pass = nullptr) {
+        std::lock_guard<std::mutex> lock(_drain_mutex);
+        if (_file == nullptr) {
+            return false;
+        }
+        UTrRing *const ring = u_tr_active_ring.load(std::memory_order_acquire);
+        if (ring != _drained) {
+            // A new file or ring starts with the records written from now on
+            _drained = ring;
+            _cursor = ring->head();
+        }
+
+        UTrDrainPass p;
+        const uint64_t start = _cursor;
+        p.lost = u_tr_drain(*ring, _file, &_cursor);
+        p.records = _cursor - start - p.lost;
+        p.backlog = ring->head() - _cursor;
+        p.capacity = ring->capacity();
+        const auto flush_start = std::chrono::steady_clock::now();
+        std::fflush(_file);
+        p.write_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - flush_start).count();
+        _records_drained += p.records;
+        _records_lost += p.lost;
+
+        if (_adaptive) {
+            const int before = _backpressure.shift();
+            const int shift = _backpressure.observe(p);
+            if (shift != before) {
+                u_tr_set_debug_throttle(shift);
+                u_tr(T_warn, "u_tr: keeping 1 in %u T_dbg traces (%s)", 1u << shift,
+                     u_tr_throttle_reason_name(_backpressure.reason()));
+            }
+        }
+        if (pass != nullptr) {
+            *pass = p;
+        }
+        return true;
+    }
+
+    UTrControlStatus status() const {
+        UTrControlStatus s;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            s.generation = _generation;
+            s.sink = _sink;
+            s.sink_path = _sink_path;
+            // A recorder opened at startup, before any configure()
+            if (_sink == UTrSinkKind::Ring &&
+                u_tr_active_ring.load(std::memory_order_acquire) != &u_tr_ring) {
+                s.sink = UTrSinkKind::Recorder;
+            }
+            if (s.sink == UTrSinkKind::Recorder) {
+                s.sink_path = _recorder_path;
+            }
+        }
+        std::lock_guard<std::mutex> lock(_drain_mutex);
+        s.adaptive = _adaptive;
+        s.debug_throttle_period = 1u << _backpressure.shift();
+        s.throttle_events = _backpressure.events();
+        s.throttle_reason = _backpressure.reason();
+        s.records_drained = _records_drained;
+        s.records_lost = _records_lost;
+        return s;
+    }
+
+private:
+    // A path that names a file inside the trace directory: relative, and
+    // without a ".." component
+    static bool _valid_sink_path(const std::string& path) {
+        if (path.front() == '/') {
+            return false;
+        }
+        std::istringstream components(path);
+        std::string component;
+        while (std::getline(components, component, '/')) {
+            if (component == "..") {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Called with _mutex held
+    std::string _in_trace_dir(const std::string& path) const {
+        return _trace_dir + "/" + path;
+    }
+
+    // Make `ring` the active ring, carrying over the records in the old one
+    static void _use_ring(UTrRing *ring) {
+        UTrRing *const active = u_tr_active_ring.load(std::memory_order_acquire);
+        if (ring != active) {
+            ring->copy_from(*active);
+            u_tr_active_ring.store(ring, std::memory_order_release);
+        }
+    }
+
+    // Called with _mutex held; takes ownership of `file`
+    void _switch_sink(UTrSinkKind kind, FILE *file, const std::string& path) {
+        _close_file();
+        switch (kind) {
+        case UTrSinkKind::Ring:
+            _use_ring(&u_tr_ring);
+            break;
+        case UTrSinkKind::File:
+            _use_ring(&u_tr_ring);
+            {
+                std::lock_guard<std::mutex> lock(_drain_mutex);
+                _file = file;
+                _drained = nullptr;
+                _drain_stop = false;
+            }
+            _drain_thread = std::thread([this] { _drain_loop(); });
+            break;
+        case UTrSinkKind::Recorder: {
+            std::lock_guard<std::mutex> lock(u_tr_flight_recorder_mutex);
+            _use_ring(&u_tr_flight_recorder->ring());
+            break;
+        }
+        }
+        _sink = kind;
+        _sink_path = kind == UTrSinkKind::File ? path : std::string();
+    }
+
+    // Stop the drain thread, print what is left and close the file. Called
+    // with _mutex held.
+    void _close_file() {
+        if (_drain_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(_drain_mutex);
+                _drain_stop = true;
+            }
+            _drain_cv.notify_all();
+            _drain_thread.join();
+        }
+        drain_once();
+        std::lock_guard<std::mutex> lock(_drain_mutex);
+        if (_file != nullptr) {
+            std::fclose(_file);
+            _file = nullptr;
+        }
+    }
+
+    void _drain_loop() {
+        std::unique_lock<std::mutex> lock(_drain_mutex);
+        while (!_drain_cv.wait_for(lock, _drain_interval, [this] { return _drain_stop; })) {
+            lock.unlock();
+            drain_once();
+            lock.lock();
+        }
+    }
+
+    const std::chrono::milliseconds _drain_interval;
+
+    // Serializes configure(); guards the sink description
+    mutable std::mutex _mutex;
+    std::string _trace_dir;
+    uint64_t _generation = 0;
+    UTrSinkKind _sink = UTrSinkKind::Ring;
+    std::string _sink_path;
+    std::string _recorder_path;
+    std::thread _drain_thread;
+
+    // Guards the drain state
+    mutable std::mutex _drain_mutex;
+    std::condition_variable _drain_cv;
+    bool _drain_stop = false;
+    FILE *_file = nullptr;
+    UTrRing *_drained = nullptr;
+    uint64_t _cursor = 0;
+    bool _adaptive = true;
+    uint64_t _records_drained = 0;
+    uint64_t _records_lost = 0;
+    UTrBackpressure _backpressure;
+};
+
+// The process' trace control; never destroyed, like the flight recorder
+inline UTrControl& u_tr_control() {
+    static UTrControl *control = new UTrControl();
+    return *control;
+}
@@ -0,0 +1,479 @@
+// Compile-time checked trace formats and binary argument serialization.
+//
+// A literal format passed to u_tr() is parsed while compiling the call and
+// checked against the argument types; a mismatch is a compile error that
+// names u_tr_format_error_* below. The call then copies each argument into
+// a UTrRecord payload at offsets fixed at compile time; no format string is
+// parsed at run time. u_tr_decode() turns a record back into text.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+
+#include "u_hash.h"
+#include "u_tr_ring.h"
+
+// Most arguments a binary trace record can carry
+constexpr uint32_t U_TR_MAX_args = 12;
+
+// Bytes of a %s argument kept in the record; longer strings are truncated
+constexpr uint32_t U_TR_STRING_width = 16;
+
+enum class UTrArgKind : uint8_t {
+    Int,
+    UInt,
+    Char,
+    Double,
+    String,
+    Pointer,
+    Invalid
+};
+
+// printf length modifier of a conversion
+enum class UTrLength : uint8_t { None, hh, h, l, ll, z, j, t };
+
+// One conversion of a format, or the serialized form of one argument
+struct UTrConversion {
+    UTrArgKind kind = UTrArgKind::Invalid;
+    UTrLength length = UTrLength::None;
+    uint8_t size = 0;           // bytes in the record payload
+};
+
+struct UTrFormatSpec {
+    uint32_t count = 0;
+    UTrConversion conv[U_TR_MAX_args] = {};
+    bool valid = true;
+};
+
+constexpr uint8_t u_tr_length_size(UTrLength length) {
+    switch (length) {
+    case UTrLength::l:  return sizeof(long);
+    case UTrLength::ll: return sizeof(long long);
+    case UTrLength::z:  return sizeof(size_t);
+    case UTrLength::j:  return sizeof(intmax_t);
+    case UTrLength::t:  return sizeof(ptrdiff_t);
+    default:            return sizeof(int);
+    }
+}
+
+// Parse the conversions of a printf format. Usable at compile time (to
+// check u_tr call sites) and at run time (to decode records).
+constexpr UTrFormatSpec u_tr_parse_format(const char *fmt) {
+    UTrFormatSpec spec;
+    for (const char *p = fmt; *p != '\0'; p++) {
+        if (*p != '%') {
+            continue;
+        }
+        p++;
+        if (*p == '%') {
+            continue;
+        }
+        while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+        if (*p == '.') {
+            p++;
+            while (*p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
+        UTrConversion conv;
+        switch (*p) {
+        case 'h': p++; conv.length = UTrLength::h;
+                  if (*p == 'h') { p++; conv.length = UTrLength::hh; } break;
+        case 'l': p++; conv.length = UTrLength::l;
+                  if (*p == 'l') { p++; conv.length = UTrLength::ll; } break;
+        case 'z': p++; conv.length = UTrLength::z; break;
+        case 'j': p++; conv.length = UTrLength::j; break;
+        case 't': p++; conv.length = UTrLength::t; break;
+        default: break;
+        }
+        switch (*p) {
+        case 'd': case 'i':
+            conv.kind = UTrArgKind::Int;
+            conv.size = u_tr_length_size(conv.length);
+            break;
+        case 'u': case 'x': case 'X': case 'o':
+            conv.kind = UTrArgKind::UInt;
+            conv.size = u_tr_length_size(conv.length);
+            break;
+        case 'c':
+            conv.kind = UTrArgKind::Char;
+            conv.size = sizeof(int);
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            conv.kind = UTrArgKind::Double;
+            conv.size = sizeof(double);
+            break;
+        case 's':
+            conv.kind = UTrArgKind::String;
+            conv.size = U_TR_STRING_width;
+            break;
+        case 'p':
+            conv.kind = UTrArgKind::Pointer;
+            conv.size = sizeof(uint64_t);
+            break;
+        default:
+            // '*' widths, %n, long double, unknown or truncated conversions
+            spec.valid = false;
+            return spec;
+        }
+        if (spec.count == U_TR_MAX_args) {
+            spec.valid = false;
+            return spec;
+        }
+        spec.conv[spec.count++] = conv;
+    }
+    return spec;
+}
+
+// Serialized form of an argument of type T
+template <typename T>
+constexpr UTrConversion u_tr_arg_conversion() {
+    using D = std::decay_t<T>;
+    UTrConversion conv;
+    if constexpr (std::is_same_v<D, char *> || std::is_same_v<D, const char *>) {
+        conv.kind = UTrArgKind::String;
+        conv.size = U_TR_STRING_width;
+    } else if constexpr (std::is_pointer_v<D> || std::is_null_pointer_v<D>) {
+        conv.kind = UTrArgKind::Pointer;
+        conv.size = sizeof(uint64_t);
+    } else if constexpr (std::is_floating_point_v<D> && !std::is_same_v<D, long double>) {
+        conv.kind = UTrArgKind::Double;
+        conv.size = sizeof(double);
+    } else if constexpr (std::is_integral_v<D> || std::is_enum_v<D>) {
+        using I = typename std::conditional_t<std::is_enum_v<D>, std::underlying_type<D>,
+                                              std::type_identity<D>>::type;
+        // Default argument promotion: anything narrower than int is passed as int
+        conv.kind = std::is_signed_v<I> || sizeof(I) < sizeof(int) ? UTrArgKind::Int
+                                                                   : UTrArgKind::UInt;
+        conv.size = sizeof(I) < sizeof(int) ? sizeof(int) : sizeof(I);
+    }
+    return conv;
+}
+
+// Can an argument serialized as `arg` be printed with `conv`? Signedness
+// may differ as long as the width matches, as printf itself allows.
+constexpr bool u_tr_compatible(UTrConversion conv, UTrConversion arg) {
+    switch (conv.kind) {
+    case UTrArgKind::Int:
+    case UTrArgKind::UInt:
+    case UTrArgKind::Char:
+        return (arg.kind == UTrArgKind::Int || arg.kind == UTrArgKind::UInt) &&
+               arg.size == conv.size;
+    case UTrArgKind::Double:
+    case UTrArgKind::String:
+        return arg.kind == conv.kind;
+    case UTrArgKind::Pointer:
+        // Not String: a char pointer is serialized as its text, which %p
+        // would misread. Cast it to const void * to trace the address.
+        return arg.kind == UTrArgKind::Pointer;
+    case UTrArgKind::Invalid:
+        break;
+    }
+    return false;
+}
+
+// Not constexpr: reaching one of these while checking a format at compile
+// time fails the build with its name in the diagnostic.
+void u_tr_format_error_unsupported_conversion();
+void u_tr_format_error_argument_count_mismatch();
+void u_tr_format_error_argument_type_mismatch();
+void u_tr_format_error_arguments_exceed_record_payload();
+
+// A literal format checked against the argument types Args. Constructed
+// implicitly from the literal at the call site, at compile time.
+template <typename... Args>
+struct UTrFormat {
+    const char *fmt;
+    uint32_t hash;
+
+    template <size_t N>
+    consteval UTrFormat(const char (&s)[N])
+        : fmt(s),
+          hash(fnv1a_32(s, N - 1))
+    {
+        const UTrFormatSpec spec = u_tr_parse_format(s);
+        if (!spec.valid) {
+            u_tr_format_error_unsupported_conversion();
+        }
+        if (spec.count != sizeof...(Args)) {
+            u_tr_format_error_argument_count_mismatch();
+        }
+        const UTrConversion args[] = { u_tr_arg_conversion<Args>()..., UTrConversion() };
+        uint32_t size = 0;
+        for (uint32_t i = 0; i < spec.count; i++) {
+            if (!u_tr_compatible(spec.conv[i], args[i])) {
+                u_tr_format_error_argument_type_mismatch();
+            }
+            size += args[i].size;
+        }
+        if (size > UTrRing::MAX_payload) {
+            u_tr_format_error_arguments_exceed_record_payload();
+        }
+    }
+};
+
+// --- Serialization ---
+
+template <typename T>
+inline void u_tr_put_arg(unsigned char *out, const T& value) {
+    using D = std::decay_t<T>;
+    constexpr UTrConversion conv = u_tr_arg_conversion<T>();
+    if constexpr (conv.kind == UTrArgKind::String) {
+        const char *s = value;
+        if (s == nullptr) {
+            s = "(null)";
+        }
+        uint32_t i = 0;
+        for (; i < U_TR_STRING_width && s[i] != '\0'; i++) {
+            out[i] = static_cast<unsigned char>(s[i]);
+        }
+        std::memset(out + i, 0, U_TR_STRING_width - i);
+    } else if constexpr (conv.kind == UTrArgKind::Pointer) {
+        const uint64_t p = reinterpret_cast<uintptr_t>(static_cast<const void *>(value));
+        std::memcpy(out, &p, sizeof(p));
+    } else if constexpr (conv.kind == UTrArgKind::Double) {
+        const double d = value;
+        std::memcpy(out, &d, sizeof(d));
+    } else if constexpr (conv.size == sizeof(int) && sizeof(D) < sizeof(int)) {
+        const int promoted = value;
+        std::memcpy(out, &promoted, sizeof(promoted));
+    } else {
+        std::memcpy(out, &value, conv.size);
+    }
+}
+
+// Write each argument at its compile-time offset; returns the payload size.
+template <typename... Args>
+inline size_t u_tr_serialize(unsigned char *payload, const Args&... args) {
+    size_t offset = 0;
+    ((u_tr_put_arg(payload + offset, args), offset += u_tr_arg_conversion<Args>().size), ...);
+    return offset;
+}
+
+// --- Format registry ---
+//
+// Records carry only the format hash. The first time a format is traced it
+// is registered here so u_tr_decode() can find it. Each registered format
+// keeps its own slot in an open-addressed table, so later calls from any
+// number of sites cost a probe or two of relaxed loads and never take the
+// mutex; the table is write-once and only fills up.
+//
+// Two formats whose 32-bit hashes collide cannot be told apart in a record.
+// The registry notices the second one and from then on decodes that hash
+// as U_TR_FORMAT_collision rather than as either text.
+
+inline constexpr const char U_TR_FORMAT_collision[] = "<format hash collision>";
+
+struct UTrFormatRegistry {
+    static constexpr uint32_t SITE_slots = 4096;
+    static constexpr uint32_t SITE_probes = 8;
+
+    // Told about each format the first time it is registered, and about
+    // U_TR_FORMAT_collision for a hash that turns out to collide, under the
+    // registry mutex, e.g. to mirror it into a flight recorder file.
+    using Listener = void (*)(void *context, uint32_t hash, const char *fmt);
+
+    // Format text registered in each slot, probed from its hash; equal
+    // pointers mean equal text and so an equal hash
+    std::atomic<const char *> sites[SITE_slots] = {};
+    std::mutex mutex;
+    std::unordered_map<uint32_t, const char *> formats;
+    Listener listener = nullptr;
+    void *listener_context = nullptr;
+
+    void note(uint32_t hash, const char *fmt) {
+        for (uint32_t probe = 0; probe < SITE_probes; probe++) {
+            const char *const registered =
+                sites[(hash + probe) % SITE_slots].load(std::memory_order_relaxed);
+            if (registered == fmt) {
+                return;
+            }
+            if (registered == nullptr) {
+                break;
+            }
+        }
+        _register(hash, fmt);
+    }
+
+    const char *lookup(uint32_t hash) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = formats.find(hash);
+        return it == formats.end() ? nullptr : it->second;
+    }
+
+    // Call fn(hash, fmt) for each registered format
+    template <typename Fn>
+    void for_each(Fn&& fn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& [hash, fmt] : formats) {
+            fn(hash, fmt);
+        }
+    }
+
+    // Install the listener and replay the formats registered so far to it,
+    // atomically with respect to note(). nullptr removes it.
+    void set_listener(Listener fn, void *context) {
+        std::lock_guard<std::mutex> lock(mutex);
+        listener = fn;
+        listener_context = context;
+        if (fn != nullptr) {
+            for (const auto& [hash, fmt] : formats) {
+                fn(context, hash, fmt);
+            }
+        }
+    }
+
+private:
+    // Slow path of note(): first call from a format this table has no slot
+    // for. The same text at another address (a literal the linker did not
+    // merge) is not a collision; it gets its own slot if one is free.
+    void _register(uint32_t hash, const char *fmt) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto [it, inserted] = formats.emplace(hash, fmt);
+        if (inserted) {
+            if (listener != nullptr) {
+                listener(listener_context, hash, fmt);
+            }
+        } else if (it->second != fmt && it->second != U_TR_FORMAT_collision &&
+                   std::strcmp(it->second, fmt) != 0) {
+            std::fprintf(stderr, "u_tr: formats \"%s\" and \"%s\" share hash %u\n",
+                         it->second, fmt, hash);
+            it->second = U_TR_FORMAT_collision;
+            if (listener != nullptr) {
+                listener(listener_context, hash, U_TR_FORMAT_collision);
+            }
+        }
+        for (uint32_t probe = 0; probe < SITE_probes; probe++) {
+            std::atomic<const char *>& site = sites[(hash + probe) % SITE_slots];
+            const char *const registered = site.load(std::memory_order_relaxed);
+            if (registered == fmt) {
+                return;
+            }
+            if (registered == nullptr) {
+                site.store(fmt, std::memory_order_relaxed);
+                return;
+            }
+        }
+        // Every slot probed is taken: this format keeps taking the mutex
+    }
+};
+
+inline UTrFormatRegistry& u_tr_format_registry() {
+    static UTrFormatRegistry registry;
+    return registry;
+}
+
+// --- Decoding ---
+
+// Print one conversion `spec` (e.g. "%08lx") of a serialized argument.
+inline int u_tr_format_arg(char *out, size_t size, const char *spec,
+                           UTrConversion conv, const unsigned char *arg) {
+    if (conv.kind == UTrArgKind::String) {
+        char s[U_TR_STRING_width + 1] = {};
+        std::memcpy(s, arg, U_TR_STRING_width);
+        return std::snprintf(out, size, spec, s);
+    }
+    if (conv.kind == UTrArgKind::Pointer) {
+        uint64_t p;
+        std::memcpy(&p, arg, sizeof(p));
+        return std::snprintf(out, size, spec, reinterpret_cast<void *>(static_cast<uintptr_t>(p)));
+    }
+    if (conv.kind == UTrArgKind::Double) {
+        double d;
+        std::memcpy(&d, arg, sizeof(d));
+        return std::snprintf(out, size, spec, d);
+    }
+    // Integers: pass the exact type the length modifier names
+    long long v = 0;
+    if (conv.size == sizeof(int)) {
+        int i;
+        std::memcpy(&i, arg, sizeof(i));
+        v = i;
+    } else {
+        std::memcpy(&v, arg, sizeof(v));
+    }
+    switch (conv.length) {
+    case UTrLength::l:  return std::snprintf(out, size, spec, static_cast<long>(v));
+    case UTrLength::ll: return std::snprintf(out, size, spec, v);
+    case UTrLength::z:  return std::snprintf(out, size, spec, static_cast<size_t>(v));
+    case UTrLength::j:  return std::snprintf(out, size, spec, static_cast<intmax_t>(v));
+    case UTrLength::t:  return std::snprintf(out, size, spec, static_cast<ptrdiff_t>(v));
+    default:            return std::snprintf(out, size, spec, static_cast<int>(v));
+    }
+}
+
+// Format a record as text using `fmt`, the format it was written with.
+// Returns the length written (truncated to `size` - 1), or -1 if there is
+// no format.
+inline int u_tr_decode(const char *fmt, const UTrRecord& record, char *out, size_t size) {
+    if (fmt == nullptr || size == 0) {
+        return -1;
+    }
+    const UTrFormatSpec parsed = u_tr_parse_format(fmt);
+    size_t len = 0;
+    size_t offset = 0;
+    uint32_t arg = 0;
+    auto append = [&](const char *s, size_t n) {
+        const size_t room = size - 1 - len;
+        n = n < room ? n : room;
+        std::memcpy(out + len, s, n);
+        len += n;
+    };
+    for (const char *p = fmt; *p != '\0';) {
+        if (*p != '%') {
+            append(p++, 1);
+            continue;
+        }
+        if (p[1] == '%') {
+            append("%", 1);
+            p += 2;
+            continue;
+        }
+        // Spec runs up to and including the conversion character
+        const char *end = p + 1;
+        while (*end != '\0' && std::strchr("diuxXocfFeEgGaAsp", *end) == nullptr) {
+            end++;
+        }
+        if (*end == '\0' || arg == parsed.count) {
+            break;
+        }
+        char spec[32];
+        const size_t spec_len = static_cast<size_t>(end - p + 1) < sizeof(spec)
+                                    ? static_cast<size_t>(end - p + 1)
+                                    : sizeof(spec) - 1;
+        std::memcpy(spec, p, spec_len);
+        spec[spec_len] = '\0';
+        p = end + 1;
+
+        const UTrConversion conv = parsed.conv[arg++];
+        if (offset + conv.size > record.payload_size) {
+            append("<?>", 3);
+            continue;
+        }
+        char value[64];
+        const int n = u_tr_format_arg(value, sizeof(value), spec, conv,
+                                      record.payload + offset);
+        offset += conv.size;
+        if (n > 0) {
+            append(value, static_cast<size_t>(n) < sizeof(value) ? n : sizeof(value) - 1);
+        }
+    }
+    out[len] = '\0';
+    return static_cast<int>(len);
+}
+
+// Format a record as text using its registered format. Returns the length
+// written (truncated to `size` - 1), or -1 if the format is unknown.
+inline int u_tr_decode(const UTrRecord& record, char *out, size_t size) {
+    return u_tr_decode(u_tr_format_registry().lookup(record.format_hash), record, out, size);
+}
@@ -0,0 +1,180 @@
+// Trace levels and the two gates every trace site passes through:
+//
+//  - compile time: U_TR_MIN_LEVEL and U_TR_DISABLED_MODULES remove sites
+//    below the level or in the listed modules entirely, arguments included.
+//  - run time: a per-module threshold, set with u_tr_set_threshold(), read
+//    with one relaxed load before any formatting or va_list work.
+//
+// T_dbg traces that pass both gates are then sampled: u_tr_sampled() keeps
+// one in every 2^shift, where shift is the module's own sample shift (see
+// u_tr_set_debug_sample_period()) plus the throttle that u_tr_control.h
+// raises while the trace sink falls behind. Other levels are never sampled.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Trace levels, least to most severe
+enum LogLevel {
+    T_dbg = 0,
+    T_info = 1,
+    T_warn = 2,
+    T_error = 3
+};
+
+// Lowest level compiled in; build with e.g. -DU_TR_MIN_LEVEL=1 to drop T_dbg
+#ifndef U_TR_MIN_LEVEL
+#define U_TR_MIN_LEVEL 0
+#endif
+
+// Comma-separated module ids whose traces are compiled out,
+// e.g. -DU_TR_DISABLED_MODULES=17,42
+#ifndef U_TR_DISABLED_MODULES
+#define U_TR_DISABLED_MODULES
+#endif
+
+// Module ids must be below this
+constexpr int U_TR_MAX_modules = 1024;
+
+// Level a module starts at until u_tr_set_threshold() changes it
+constexpr int U_TR_DEFAULT_threshold = T_info;
+
+// Largest sample shift: keep at least 1 in 65536 T_dbg traces
+constexpr int U_TR_MAX_sample_shift = 16;
+
+// Is a trace site of this module and level compiled in at all?
+constexpr bool u_tr_compiled_in(int module, int level) {
+    constexpr int disabled[] = { -1, U_TR_DISABLED_MODULES };
+    if (level < U_TR_MIN_LEVEL) {
+        return false;
+    }
+    for (int m : disabled) {
+        if (m == module) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runtime threshold per module. Initialized dynamically, so a trace issued
+// from another static initializer before this one runs sees threshold 0
+// and is emitted.
+struct UTrThresholds {
+    std::atomic<uint8_t> level[U_TR_MAX_modules];
+    // log2 of the T_dbg sample period, per module and for all modules
+    std::atomic<uint8_t> sample_shift[U_TR_MAX_modules];
+    std::atomic<uint8_t> throttle_shift;
+
+    UTrThresholds() {
+        for (auto& l : level) {
+            l.store(U_TR_DEFAULT_threshold, std::memory_order_relaxed);
+        }
+        for (auto& s : sample_shift) {
+            s.store(0, std::memory_order_relaxed);
+        }
+        throttle_shift.store(0, std::memory_order_relaxed);
+    }
+};
+
+inline UTrThresholds u_tr_thresholds;
+
+// Is `module` a valid module id? The runtime functions below take ids that
+// need not be constants, so each checks with this before indexing: setters
+// ignore a bad id, getters report the defaults for it, and its traces are
+// never enabled. One unsigned compare, folded away for constant ids.
+constexpr bool u_tr_module_valid(int module) {
+    return static_cast<unsigned>(module) < static_cast<unsigned>(U_TR_MAX_modules);
+}
+
+// Emit traces of `module` at `level` and above.
+inline void u_tr_set_threshold(int module, int level) {
+    if (!u_tr_module_valid(module)) {
+        return;
+    }
+    u_tr_thresholds.level[module].store(static_cast<uint8_t>(level),
+                                        std::memory_order_relaxed);
+}
+
+inline int u_tr_get_threshold(int module) {
+    if (!u_tr_module_valid(module)) {
+        return U_TR_DEFAULT_threshold;
+    }
+    return u_tr_thresholds.level[module].load(std::memory_order_relaxed);
+}
+
+// Runtime gate: one relaxed load.
+inline bool u_tr_enabled(int module, int level) {
+    return u_tr_module_valid(module) &&
+           level >= u_tr_thresholds.level[module].load(std::memory_order_relaxed);
+}
+
+// Keep 1 in `period` T_dbg traces of `module`, with period rounded up to a
+// power of two and capped at 2^U_TR_MAX_sample_shift; 1 keeps them all.
+inline void u_tr_set_debug_sample_period(int module, uint32_t period) {
+    if (!u_tr_module_valid(module)) {
+        return;
+    }
+    int shift = 0;
+    while (shift < U_TR_MAX_sample_shift && (uint32_t{1} << shift) < period) {
+        shift++;
+    }
+    u_tr_thresholds.sample_shift[module].store(static_cast<uint8_t>(shift),
+                                               std::memory_order_relaxed);
+}
+
+inline uint32_t u_tr_get_debug_sample_period(int module) {
+    if (!u_tr_module_valid(module)) {
+        return 1;
+    }
+    return uint32_t{1} << u_tr_thresholds.sample_shift[module].load(std::memory_order_relaxed);
+}
+
+// Extra sample shift applied to every module; set by the sink's backpressure.
+inline void u_tr_set_debug_throttle(int shift) {
+    u_tr_thresholds.throttle_shift.store(static_cast<uint8_t>(shift), std::memory_order_relaxed);
+}
+
+inline int u_tr_get_debug_throttle() {
+    return u_tr_thresholds.throttle_shift.load(std::memory_order_relaxed);
+}
+
+// Sampling gate, after u_tr_enabled(): true for every trace above T_dbg and
+// for 1 in 2^shift T_dbg traces. The count is per thread, not per module,
+// so a module's share is kept on average rather than exactly.
+inline bool u_tr_sampled(int module, int level) {
+    if (level > T_dbg) {
+        return true;
+    }
+    if (!u_tr_module_valid(module)) {
+        return false;
+    }
+    int shift = u_tr_thresholds.sample_shift[module].load(std::memory_order_relaxed) +
+                u_tr_thresholds.throttle_shift.load(std::memory_order_relaxed);
+    if (shift == 0) {
+        return true;
+    }
+    if (shift > U_TR_MAX_sample_shift) {
+        shift = U_TR_MAX_sample_shift;
+    }
+    thread_local uint32_t tick = 0;
+    return (++tick & ((uint32_t{1} << shift) - 1)) == 0;
+}
+
+// Run the statement in the trailing arguments only for a trace site that
+// passes every gate: sites compiled out by U_TR_MIN_LEVEL or
+// U_TR_DISABLED_MODULES generate no code, sites below the module's runtime
+// threshold cost one relaxed load, and T_dbg sites are then sampled. The
+// statement, and so the trace arguments, is only evaluated once all pass.
+// `module` must be a constant expression.
+#define U_TR_GATED(module, level, ...)                                  \
+    do {                                                                \
+        static_assert((module) >= 0 && (module) < U_TR_MAX_modules,     \
+                      "trace module id out of range");                  \
+        if constexpr (u_tr_compiled_in((module), (level))) {            \
+            if (u_tr_enabled((module), (level)) &&                      \
+                u_tr_sampled((module), (level))) {                      \
+                __VA_ARGS__;                                            \
+            }                                                           \
+        }                                                               \
+    } while (0)
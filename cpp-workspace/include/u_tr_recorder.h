@@ -0,0 +1,445 @@
+// Flight recorder: the trace ring in a memory-mapped file, so the last
+// records survive an abort, a SIGKILL or a watchdog restart of the process.
+//
+// u_tr_flight_recorder_open() creates the file, mirrors everything needed
+// to decode the records into it (clock calibration and bases, the text of
+// every format traced) and switches u_tr() over to a ring inside it. The
+// file is MAP_SHARED, so stores to it reach the page cache as they happen;
+// nothing has to run when the process dies. UTrRecorderImage (and the
+// u_tr_dump tool built on it) decodes such a file afterwards, or a file
+// written on demand by u_tr_snapshot().
+//
+// File layout, all offsets from the start of the file:
+//   0                     UTrRecorderHeader, padded to 4 KiB
+//   bases_offset          UTrClock::EPOCH_history UTrRecorderBase entries
+//   formats_offset        formats_size bytes of UTrRecorderFormat entries
+//   ring_offset           UTrRingHeader and ring_capacity UTrRecords
+//
+// POSIX only.
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "u_tr.h"
+
+constexpr char U_TR_RECORDER_magic[8] = { 'U', 'T', 'R', 'F', 'L', 'I', 'T', 'E' };
+constexpr uint32_t U_TR_RECORDER_version = 2;
+
+// Room for format text in the file; formats that do not fit decode as unknown
+constexpr size_t U_TR_RECORDER_format_bytes = 256 * 1024;
+
+// Default ring size of the flight recorder, in records (4 MiB of records)
+constexpr size_t U_TR_RECORDER_capacity = 1 << 16;
+
+struct UTrRecorderHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t file_size;
+    uint64_t bases_offset;
+    uint64_t formats_offset;
+    uint64_t formats_size;
+    uint64_t ring_offset;
+    uint64_t ring_capacity;
+    int64_t pid;
+    UTrClock::Calibration calibration;
+    // Bytes of the format area in use; entries below it are complete
+    std::atomic<uint64_t> formats_used;
+    // Formats that did not fit
+    std::atomic<uint64_t> formats_dropped;
+};
+
+constexpr size_t U_TR_RECORDER_header_bytes = 4096;
+static_assert(sizeof(UTrRecorderHeader) <= U_TR_RECORDER_header_bytes);
+
+// Copy of one UTrClock base
+struct UTrRecorderBase {
+    std::atomic<uint64_t> ticks;
+    std::atomic<uint32_t> epoch;
+    uint32_t reserved;
+};
+
+// Format entry: `length` bytes of text and a NUL follow, padded to 8 bytes
+struct UTrRecorderFormat {
+    uint32_t hash;
+    uint32_t length;
+};
+
+// --- Writing ---
+
+// A recorder file mapped for writing. Fills in the decoding state either
+// once from the live process (seed) or continuously (attach) as the clock
+// rebases and new formats are registered.
+class UTrRecorderFile final : public UTrClock::Listener {
+public:
+    UTrRecorderFile() = default;
+    UTrRecorderFile(const UTrRecorderFile&) = delete;
+    UTrRecorderFile& operator=(const UTrRecorderFile&) = delete;
+
+    ~UTrRecorderFile() {
+        detach();
+        _ring.reset();
+        if (_map != nullptr) {
+            munmap(_map, _size);
+        }
+        if (_fd >= 0) {
+            close(_fd);
+        }
+    }
+
+    // Create (or truncate) `path` for a ring of `capacity` records, a power
+    // of two. Returns 0 or an errno value.
+    int create(const char *path, size_t capacity) {
+        if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+            return EINVAL;
+        }
+        const uint64_t bases_offset = U_TR_RECORDER_header_bytes;
+        const uint64_t formats_offset = bases_offset + UTrClock::EPOCH_history * sizeof(UTrRecorderBase);
+        const uint64_t ring_offset = formats_offset + U_TR_RECORDER_format_bytes;
+        _size = ring_offset + UTrRing::storage_size(capacity);
+
+        // O_NOFOLLOW: never truncate whatever a symlink at `path` points to
+        _fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0644);
+        if (_fd < 0) {
+            return errno;
+        }
+        // Allocate the blocks now so a full disk fails here, not as SIGBUS
+        // on a trace store later
+        const int err = posix_fallocate(_fd, 0, static_cast<off_t>(_size));
+        if (err != 0) {
+            return err;
+        }
+        void *map = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        if (map == MAP_FAILED) {
+            return errno;
+        }
+        _map = static_cast<unsigned char *>(map);
+
+        _header = reinterpret_cast<UTrRecorderHeader *>(_map);
+        _header->version = U_TR_RECORDER_version;
+        _header->record_size = sizeof(UTrRecord);
+        _header->file_size = _size;
+        _header->bases_offset = bases_offset;
+        _header->formats_offset = formats_offset;
+        _header->formats_size = U_TR_RECORDER_format_bytes;
+        _header->ring_offset = ring_offset;
+        _header->ring_capacity = capacity;
+        _header->pid = getpid();
+        _header->formats_used.store(0, std::memory_order_relaxed);
+        _header->formats_dropped.store(0, std::memory_order_relaxed);
+        _bases = reinterpret_cast<UTrRecorderBase *>(_map + bases_offset);
+        for (uint32_t i = 0; i < UTrClock::EPOCH_history; i++) {
+            _bases[i].epoch.store(UINT32_MAX, std::memory_order_relaxed);
+        }
+        _ring.reset(new UTrRing(_map + ring_offset, capacity, true));
+        // Magic last: a file without it was never completely set up
+        std::memcpy(_header->magic, U_TR_RECORDER_magic, sizeof(_header->magic));
+        return 0;
+    }
+
+    UTrRing& ring() { return *_ring; }
+
+    // Copy the current calibration, bases and formats of the process
+    void seed() {
+        on_calibrate(u_tr_clock.calibration());
+        u_tr_clock.for_each_base([this](uint16_t epoch, uint64_t ticks) { on_rebase(epoch, ticks); });
+        u_tr_format_registry().for_each([this](uint32_t hash, const char *fmt) { add_format(hash, fmt); });
+    }
+
+    // Keep the file up to date with the clock and format registry until
+    // detach(). Replaces seed().
+    void attach() {
+        // Calibrate now if nobody has; set_listener() hands the result over
+        u_tr_clock.calibration();
+        u_tr_clock.set_listener(this);
+        u_tr_clock.for_each_base([this](uint16_t epoch, uint64_t ticks) { on_rebase(epoch, ticks); });
+        u_tr_format_registry().set_listener(&UTrRecorderFile::_format_listener, this);
+        _attached = true;
+    }
+
+    void detach() {
+        if (_attached) {
+            u_tr_format_registry().set_listener(nullptr, nullptr);
+            u_tr_clock.set_listener(nullptr);
+            _attached = false;
+        }
+    }
+
+    // Write the file back to disk now; the kernel does so eventually anyway
+    int sync() {
+        return msync(_map, _size, MS_SYNC) == 0 ? 0 : errno;
+    }
+
+    void on_calibrate(const UTrClock::Calibration& calibration) override {
+        _header->calibration = calibration;
+    }
+
+    void on_rebase(uint16_t epoch, uint64_t base_ticks) override {
+        UTrRecorderBase& b = _bases[epoch];
+        b.ticks.store(base_ticks, std::memory_order_relaxed);
+        b.epoch.store(epoch, std::memory_order_release);
+    }
+
+    // Callers serialize, the registry through its mutex
+    void add_format(uint32_t hash, const char *fmt) {
+        const uint64_t used = _header->formats_used.load(std::memory_order_relaxed);
+        const size_t length = std::strlen(fmt);
+        const uint64_t entry = (sizeof(UTrRecorderFormat) + length + 1 + 7) & ~uint64_t(7);
+        if (used + entry > _header->formats_size) {
+            _header->formats_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        unsigned char *p = _map + _header->formats_offset + used;
+        const UTrRecorderFormat f = { hash, static_cast<uint32_t>(length) };
+        std::memcpy(p, &f, sizeof(f));
+        std::memcpy(p + sizeof(f), fmt, length + 1);
+        _header->formats_used.store(used + entry, std::memory_order_release);
+    }
+
+private:
+    static void _format_listener(void *context, uint32_t hash, const char *fmt) {
+        static_cast<UTrRecorderFile *>(context)->add_format(hash, fmt);
+    }
+
+    int _fd = -1;
+    unsigned char *_map = nullptr;
+    size_t _size = 0;
+    UTrRecorderHeader *_header = nullptr;
+    UTrRecorderBase *_bases = nullptr;
+    std::unique_ptr<UTrRing> _ring;
+    bool _attached = false;
+};
+
+// The process' flight recorder; never closed, since u_tr() callers may
+// still be writing to its ring
+inline UTrRecorderFile *u_tr_flight_recorder = nullptr;
+inline std::mutex u_tr_flight_recorder_mutex;
+
+// Create the process' flight recorder at `path`, keeping the last
+// `capacity` records, without making its ring the active one: u_tr() keeps
+// writing where it did until the caller switches. Returns 0, EALREADY if a
+// recorder is already open, or the errno value that made creating the
+// file fail.
+inline int u_tr_flight_recorder_create(const char *path, size_t capacity = U_TR_RECORDER_capacity) {
+    std::lock_guard<std::mutex> lock(u_tr_flight_recorder_mutex);
+    if (u_tr_flight_recorder != nullptr) {
+        return EALREADY;
+    }
+    std::unique_ptr<UTrRecorderFile> file(new UTrRecorderFile());
+    const int err = file->create(path, capacity);
+    if (err != 0) {
+        return err;
+    }
+    file->attach();
+    u_tr_flight_recorder = file.release();
+    return 0;
+}
+
+// Start recording u_tr() traces to `path`, keeping the last `capacity`
+// records. Records already in the active ring are carried over. Call early
+// at startup. Returns as u_tr_flight_recorder_create().
+inline int u_tr_flight_recorder_open(const char *path, size_t capacity = U_TR_RECORDER_capacity) {
+    const int err = u_tr_flight_recorder_create(path, capacity);
+    if (err != 0) {
+        return err;
+    }
+    std::lock_guard<std::mutex> lock(u_tr_flight_recorder_mutex);
+    UTrRing& ring = u_tr_flight_recorder->ring();
+    ring.copy_from(*u_tr_active_ring.load(std::memory_order_acquire));
+    u_tr_active_ring.store(&ring, std::memory_order_release);
+    return 0;
+}
+
+// Write the active ring and what is needed to decode it to `path`, in the
+// flight recorder format. `records`, if given, is set to the number of
+// records written. Returns 0 or an errno value.
+inline int u_tr_snapshot(const char *path, uint64_t *records = nullptr) {
+    const UTrRing& active = *u_tr_active_ring.load(std::memory_order_acquire);
+    UTrRecorderFile file;
+    int err = file.create(path, active.capacity());
+    if (err != 0) {
+        return err;
+    }
+    file.seed();
+    const uint64_t copied = file.ring().copy_from(active);
+    err = file.sync();
+    if (err == 0 && records != nullptr) {
+        *records = copied;
+    }
+    return err;
+}
+
+// --- Reading ---
+
+// A recorder file mapped read-only for decoding, possibly written by a
+// process that has since died.
+class UTrRecorderImage {
+public:
+    UTrRecorderImage() = default;
+    UTrRecorderImage(const UTrRecorderImage&) = delete;
+    UTrRecorderImage& operator=(const UTrRecorderImage&) = delete;
+
+    ~UTrRecorderImage() {
+        _ring.reset();
+        if (_map != nullptr) {
+            munmap(_map, _size);
+        }
+    }
+
+    // Returns 0, EINVAL if `path` is not a complete recorder file, or errno
+    int open(const char *path) {
+        const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return errno;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            const int err = errno;
+            close(fd);
+            return err;
+        }
+        _size = static_cast<size_t>(st.st_size);
+        if (_size < U_TR_RECORDER_header_bytes) {
+            close(fd);
+            return EINVAL;
+        }
+        void *map = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            return errno;
+        }
+        _map = static_cast<unsigned char *>(map);
+        _header = reinterpret_cast<const UTrRecorderHeader *>(_map);
+
+        const UTrRecorderHeader& h = *_header;
+        if (std::memcmp(h.magic, U_TR_RECORDER_magic, sizeof(h.magic)) != 0 ||
+            h.version != U_TR_RECORDER_version || h.record_size != sizeof(UTrRecord) ||
+            h.file_size != _size || h.ring_capacity == 0 ||
+            (h.ring_capacity & (h.ring_capacity - 1)) != 0 || !_valid_layout(h, _size)) {
+            return EINVAL;
+        }
+        _bases = reinterpret_cast<const UTrRecorderBase *>(_map + h.bases_offset);
+        _ring.reset(new UTrRing(_map + h.ring_offset, h.ring_capacity, false));
+
+        const unsigned char *formats = _map + h.formats_offset;
+        uint64_t used = h.formats_used.load(std::memory_order_acquire);
+        used = used < h.formats_size ? used : h.formats_size;
+        for (uint64_t offset = 0; offset + sizeof(UTrRecorderFormat) <= used;) {
+            UTrRecorderFormat f;
+            std::memcpy(&f, formats + offset, sizeof(f));
+            const uint64_t entry = (sizeof(f) + f.length + 1 + 7) & ~uint64_t(7);
+            if (offset + entry > used || formats[offset + sizeof(f) + f.length] != '\0') {
+                break;
+            }
+            // A later entry for a hash is U_TR_FORMAT_collision and wins
+            _formats[f.hash] = reinterpret_cast<const char *>(formats + offset + sizeof(f));
+            offset += entry;
+        }
+        return 0;
+    }
+
+    const UTrRecorderHeader& header() const { return *_header; }
+
+    const UTrRing& ring() const { return *_ring; }
+
+    const char *format(uint32_t hash) const {
+        auto it = _formats.find(hash);
+        return it == _formats.end() ? nullptr : it->second;
+    }
+
+    // Wall time of a stamp in ns since the Unix epoch. False if the base of
+    // its epoch is not in the file.
+    bool realtime_ns(UTrStamp stamp, int64_t *out) const {
+        uint64_t ticks = stamp.delta;
+        if (stamp.epoch != 0) {
+            const UTrRecorderBase& b = _bases[stamp.epoch];
+            if (b.epoch.load(std::memory_order_acquire) != stamp.epoch) {
+                return false;
+            }
+            ticks += b.ticks.load(std::memory_order_relaxed);
+        }
+        const UTrClock::Calibration& c = _header->calibration;
+        const double d = static_cast<double>(static_cast<int64_t>(ticks - c.ticks0));
+        *out = c.realtime_ns0 + static_cast<int64_t>(d * c.ns_per_tick);
+        return true;
+    }
+
+    // Print every readable record, oldest first, like u_tr_drain(). Returns
+    // the number printed; *torn, if given, counts records that were being
+    // written when the file was last touched.
+    uint64_t dump(FILE *out, uint64_t *torn = nullptr) const {
+        const uint64_t head = _ring->head();
+        const uint64_t first = head > _ring->capacity() ? head - _ring->capacity() : 0;
+        uint64_t printed = 0;
+        UTrRecord record;
+        char text[1024];
+        char when[32];
+        for (uint64_t index = first; index < head; index++) {
+            if (!_ring->read(index, &record)) {
+                if (torn != nullptr) {
+                    ++*torn;
+                }
+                continue;
+            }
+            int64_t ns;
+            if (realtime_ns(record.stamp(), &ns)) {
+                std::snprintf(when, sizeof(when), "%lld.%09lld",
+                              static_cast<long long>(ns / 1000000000),
+                              static_cast<long long>(ns % 1000000000));
+            } else {
+                std::snprintf(when, sizeof(when), "?");
+            }
+            u_tr_print_record(out, when, record,
+                              u_tr_decode(format(record.format_hash), record, text, sizeof(text)) < 0
+                                  ? nullptr : text);
+            printed++;
+        }
+        return printed;
+    }
+
+private:
+    // The header may come from a corrupt or hostile file: check each offset
+    // and size against the file on its own before adding any of them, so
+    // no sum can wrap past the checks
+    static bool _valid_layout(const UTrRecorderHeader& h, size_t size) {
+        const uint64_t bases_size = UTrClock::EPOCH_history * sizeof(UTrRecorderBase);
+        if (h.bases_offset > size || h.formats_offset > size || h.formats_size > size ||
+            h.ring_offset > size) {
+            return false;
+        }
+        if (h.bases_offset < U_TR_RECORDER_header_bytes ||
+            h.bases_offset % alignof(UTrRecorderBase) != 0 ||
+            h.formats_offset % alignof(UTrRecorderFormat) != 0 ||
+            h.ring_offset % alignof(UTrRingHeader) != 0) {
+            return false;
+        }
+        if (bases_size > size - h.bases_offset || h.bases_offset + bases_size > h.formats_offset ||
+            h.formats_size > size - h.formats_offset ||
+            h.formats_offset + h.formats_size > h.ring_offset) {
+            return false;
+        }
+        const uint64_t ring_room = size - h.ring_offset;
+        return ring_room >= sizeof(UTrRingHeader) &&
+               h.ring_capacity <= (ring_room - sizeof(UTrRingHeader)) / sizeof(UTrRecord);
+    }
+
+    unsigned char *_map = nullptr;
+    size_t _size = 0;
+    const UTrRecorderHeader *_header = nullptr;
+    const UTrRecorderBase *_bases = nullptr;
+    std::unique_ptr<UTrRing> _ring;
+    std::unordered_map<uint32_t, const char *> _formats;
+};
@@ -0,0 +1,176 @@
+// Binary trace ring: fixed-size records, many writers, overwrite-oldest.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "u_tr_clock.h"
+
+// One trace record. The format string is not stored, only its hash; the
+// arguments are stored in their binary form and decoded offline.
+struct alignas(64) UTrRecord {
+    // Ring index + 1 once the record is complete, 0 while it is being written
+    std::atomic<uint64_t> seq;
+    uint32_t format_hash;
+    // Time the record was written, see u_tr_clock.h
+    uint32_t tsc_delta;
+    uint16_t module;
+    uint16_t epoch;
+    uint8_t level;
+    uint8_t payload_size;
+    unsigned char payload[42];
+
+    UTrStamp stamp() const { return { epoch, tsc_delta }; }
+};
+static_assert(sizeof(UTrRecord) == 64, "UTrRecord must fill one cache line");
+
+// Ring state kept with the records, so a ring in shared or file-backed
+// memory can be read back by another process. The records follow it.
+struct alignas(64) UTrRingHeader {
+    uint64_t capacity;
+    std::atomic<uint64_t> head;
+};
+static_assert(sizeof(UTrRingHeader) == 64, "records must stay cache line aligned");
+
+// Ring of UTrRecords. Writers never block or wait for readers: each claims
+// the next index with one atomic add and overwrites whatever was there.
+// Readers detect records that were overwritten or are still being written
+// through the per-record sequence number, like a seqlock.
+//
+// The ring owns heap storage, or lives in storage the caller provides, e.g.
+// an mmap()ed file that outlives the process (see u_tr_recorder.h).
+class UTrRing {
+public:
+    static constexpr size_t MAX_payload = sizeof(UTrRecord::payload);
+
+    // Bytes of storage a ring of `capacity` records needs
+    static constexpr size_t storage_size(size_t capacity) {
+        return sizeof(UTrRingHeader) + capacity * sizeof(UTrRecord);
+    }
+
+    // capacity must be a power of two
+    explicit UTrRing(size_t capacity)
+        : _owned(true)
+    {
+        _attach(::operator new(storage_size(capacity), std::align_val_t(64)), capacity, true);
+    }
+
+    // Ring in storage_size(capacity) bytes of 64-byte aligned `memory`.
+    // With `initialize` false the header and records found there are kept.
+    UTrRing(void *memory, size_t capacity, bool initialize)
+        : _owned(false)
+    {
+        _attach(memory, capacity, initialize);
+    }
+
+    UTrRing(const UTrRing&) = delete;
+    UTrRing& operator=(const UTrRing&) = delete;
+
+    ~UTrRing()
+    {
+        if (_owned) {
+            ::operator delete(static_cast<void *>(_header), std::align_val_t(64));
+        }
+    }
+
+    size_t capacity() const { return _mask + 1; }
+
+    // Index the next record will be written at; every index below it has
+    // been claimed by a writer.
+    uint64_t head() const { return _header->head.load(std::memory_order_acquire); }
+
+    // Append a record; payload beyond MAX_payload bytes is truncated.
+    uint64_t write(uint32_t format_hash, uint16_t module, uint8_t level,
+                   UTrStamp stamp, const void *payload, size_t size)
+    {
+        const uint64_t index = _header->head.fetch_add(1, std::memory_order_relaxed);
+        UTrRecord& r = _records[index & _mask];
+        r.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        r.format_hash = format_hash;
+        r.tsc_delta = stamp.delta;
+        r.module = module;
+        r.epoch = stamp.epoch;
+        r.level = level;
+        r.payload_size = static_cast<uint8_t>(size < MAX_payload ? size : MAX_payload);
+        std::memcpy(r.payload, payload, r.payload_size);
+        r.seq.store(index + 1, std::memory_order_release);
+        return index;
+    }
+
+    // Copy out the record at `index`. Returns false if it has not been
+    // completely written yet or has already been overwritten.
+    bool read(uint64_t index, UTrRecord *out) const
+    {
+        const UTrRecord& r = _records[index & _mask];
+        if (r.seq.load(std::memory_order_acquire) != index + 1) {
+            return false;
+        }
+        out->format_hash = r.format_hash;
+        out->tsc_delta = r.tsc_delta;
+        out->module = r.module;
+        out->epoch = r.epoch;
+        out->level = r.level;
+        out->payload_size = r.payload_size;
+        std::memcpy(out->payload, r.payload, sizeof(out->payload));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (r.seq.load(std::memory_order_relaxed) != index + 1) {
+            return false;
+        }
+        out->seq.store(index + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Copy the records of `src` still readable into this ring at the same
+    // indices and move the head to src's. Returns the number copied. Records
+    // written to src meanwhile may be missed, so quiesce writers or accept
+    // losing them.
+    uint64_t copy_from(const UTrRing& src)
+    {
+        const uint64_t head = src.head();
+        const uint64_t window = capacity() < src.capacity() ? capacity() : src.capacity();
+        uint64_t copied = 0;
+        UTrRecord record;
+        for (uint64_t index = head > window ? head - window : 0; index < head; index++) {
+            UTrRecord& r = _records[index & _mask];
+            r.seq.store(0, std::memory_order_relaxed);
+            if (!src.read(index, &record)) {
+                continue;
+            }
+            r.format_hash = record.format_hash;
+            r.tsc_delta = record.tsc_delta;
+            r.module = record.module;
+            r.epoch = record.epoch;
+            r.level = record.level;
+            r.payload_size = record.payload_size;
+            std::memcpy(r.payload, record.payload, sizeof(r.payload));
+            r.seq.store(index + 1, std::memory_order_release);
+            copied++;
+        }
+        _header->head.store(head, std::memory_order_release);
+        return copied;
+    }
+
+private:
+    void _attach(void *memory, size_t capacity, bool initialize)
+    {
+        _header = static_cast<UTrRingHeader *>(memory);
+        _records = reinterpret_cast<UTrRecord *>(_header + 1);
+        _mask = capacity - 1;
+        if (initialize) {
+            _header->capacity = capacity;
+            _header->head.store(0, std::memory_order_relaxed);
+            for (size_t i = 0; i < capacity; i++) {
+                _records[i].seq.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    const bool _owned;
+    UTrRingHeader *_header;
+    UTrRecord *_records;
+    uint64_t _mask;
+};
@@ -25,20 +25,13 @@
 #include "wb_transaction_impl.h"
 #include "wb_types.h"
 #include "WbConfigData.h"
+#include "u_prof.h"
+#include "u_tr_clock.h"
+#include "u_tr_control.h"
+#include "u_tr_recorder.h"
 
 namespace ltf {
 
-/**
- * @brief Test Nvo Types
- * @todo  Update when new types are supported
- */
-std::unordered_map<std::string, NvObjectType> test_nvo_types = {
-    { "Test1", NvObjectType::Test1 },
-    { "Test2", NvObjectType::Test2 },
-    { "Test3", NvObjectType::Test3 },
-    { "Test4", NvObjectType::Test4 }
-};
-
 /**
  * @typedef CommitOpStatusPointer
  *
@@ -52,6 +45,9 @@ using namespace ltf;
 Status MoyoImpl::ltf_trace_record_enable(ServerContext* context,
                                       const LtfTraceRecordEnableRequest* request,
                                       LtfTraceRecordEnableResponse* response) override {
+    LatencyScope latency(get_latency_stats(NODE_latency_stats_id)->histogram(
+        LatencyMetric::MoyoLtfTraceRecordEnable));
+
     // Check if the file path is valid and the user has permissions to write to it
     if (!isValidFilePath(request->file_path())) {
         response->mutable_status()->set_error(MoyoErrorCode::Failed);
@@ -66,8 +62,19 @@ Status MoyoImpl::ltf_trace_record_enable(ServerContext* context,
         return Status::OK;
     }
 
-    // Start recording
-    startRecording(request->file_path(), request->sampling_rate(), request->duration_seconds());
+    // Start recording off the RPC thread; calibrating alone takes 10ms
+    const std::string file_path = request->file_path();
+    const float sampling_rate = request->sampling_rate();
+    const int duration_seconds = request->duration_seconds();
+    std::vector<TaskChunk> chunks;
+    chunks.push_back({ [this, file_path, sampling_rate, duration_seconds](const TaskContext&) {
+        startRecording(file_path, sampling_rate, duration_seconds);
+        return 0;
+    } });
+    response->set_job_id(_task_scheduler.submit("trace_record",
+                                                TaskScheduler::NODE_dsp_internal_id,
+                                                TaskPriority::Diagnostic,
+                                                std::move(chunks)));
 
     response->mutable_status()->set_error(MoyoErrorCode::Success);
     response->mutable_status()->set_text("Trace recording started");
@@ -75,6 +82,270 @@ Status MoyoImpl::ltf_trace_record_enable(ServerContext* context,
     return Status::OK;
 }
 
+/**
+ * @brief Percentiles reported when the request does not name any.
+ */
+static const double DEFAULT_latency_percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+
+Status MoyoImpl::ltfLatencyHistograms(ServerContext* context,
+                                      const LtfLatencyHistogramsRequest* request,
+                                      LtfLatencyHistogramsResponse* response) {
+    LatencyScope latency(get_latency_stats(NODE_latency_stats_id)->histogram(
+        LatencyMetric::MoyoLtfLatencyHistograms));
+
+    std::vector<double> percentiles(request->percentiles().begin(),
+                                    request->percentiles().end());
+    if (percentiles.empty()) {
+        percentiles.assign(std::begin(DEFAULT_latency_percentiles),
+                           std::end(DEFAULT_latency_percentiles));
+    }
+    for (const double percentile : percentiles) {
+        /* Written so that NaN fails too */
+        if (!(percentile >= 0.0 && percentile <= 100.0)) {
+            response->mutable_status()->set_error(MoyoErrorCode::Failed);
+            response->mutable_status()->set_text("Percentile out of range");
+            return Status::OK;
+        }
+    }
+
+    /* Only ids that have recorded have histograms; do not create them here */
+    DspLatencyStats* const stats = find_latency_stats(request->dsp_internal_id());
+    if (stats == nullptr) {
+        response->mutable_status()->set_error(MoyoErrorCode::Failed);
+        response->mutable_status()->set_text(
+            "No latency histograms for DSP internal id " +
+            std::to_string(request->dsp_internal_id()));
+        return Status::OK;
+    }
+    for (uint32_t i = 0; i < static_cast<uint32_t>(LatencyMetric::Count); i++) {
+        const LatencyMetric metric = static_cast<LatencyMetric>(i);
+        const LatencySnapshot snapshot =
+            stats->histogram(metric).snapshot(request->reset());
+
+        LtfLatencyHistogram* const histogram = response->add_histograms();
+        histogram->set_name(latency_metric_name(metric));
+        histogram->set_count(snapshot.count);
+        histogram->set_sum_ns(snapshot.sum_ns);
+        histogram->set_max_ns(snapshot.max_ns);
+        for (const double percentile : percentiles) {
+            LtfLatencyPercentile* const p = histogram->add_percentiles();
+            p->set_percentile(percentile);
+            p->set_value_ns(snapshot.percentile(percentile));
+        }
+    }
+
+    response->mutable_status()->set_error(MoyoErrorCode::Success);
+    return Status::OK;
+}
+
+Status MoyoImpl::ltfFlightRecorderSnapshot(ServerContext* context,
+                                           const LtfFlightRecorderSnapshotRequest* request,
+                                           LtfFlightRecorderSnapshotResponse* response) {
+    LatencyScope latency(get_latency_stats(NODE_latency_stats_id)->histogram(
+        LatencyMetric::MoyoLtfFlightRecorderSnapshot));
+
+    /* Snapshots go in the trace directory, like trace sink files */
+    std::string file_path;
+    if (!u_tr_control().trace_file_path(request->file_path(), &file_path)) {
+        response->mutable_status()->set_error(MoyoErrorCode::Failed);
+        response->mutable_status()->set_text("Invalid file path");
+        return Status::OK;
+    }
+
+    /*
+     * Copying the ring and syncing the file can take as long as the disk
+     * does, so write it from a job rather than on the RPC thread. A failure
+     * shows up as the job's error.
+     */
+    const UTrRing& ring = *u_tr_active_ring.load(std::memory_order_acquire);
+    const uint64_t head = ring.head();
+    std::vector<TaskChunk> chunks;
+    chunks.push_back({ [file_path](const TaskContext&) {
+        return u_tr_snapshot(file_path.c_str());
+    }, true });
+    response->set_job_id(_task_scheduler.submit("flight_recorder_snapshot",
+                                                TaskScheduler::NODE_dsp_internal_id,
+                                                TaskPriority::Diagnostic,
+                                                std::move(chunks)));
+
+    response->set_record_count(head < ring.capacity() ? head : ring.capacity());
+    response->mutable_status()->set_error(MoyoErrorCode::Success);
+    return Status::OK;
+}
+
+Status MoyoImpl::ltfBackgroundJobs(ServerContext* context,
+                                   const LtfBackgroundJobsRequest* request,
+                                   LtfBackgroundJobsResponse* response) {
+    LatencyScope latency(get_latency_stats(NODE_latency_stats_id)->histogram(
+        LatencyMetric::MoyoLtfBackgroundJobs));
+
+    std::vector<JobStatus> jobs;
+    if (request->job_id() == 0) {
+        jobs = _task_scheduler.jobs();
+    } else {
+        JobStatus status;
+        if (!_task_scheduler.status(request->job_id(), &status)) {
+            response->mutable_status()->set_error(MoyoErrorCode::Failed);
+            response->mutable_status()->set_text("No such background job");
+            return Status::OK;
+        }
+        jobs.push_back(status);
+    }
+
+    for (const JobStatus& status : jobs) {
+        LtfBackgroundJob* const job = response->add_jobs();
+        job->set_job_id(status.job_id);
+        job->set_name(status.name);
+        job->set_dsp_internal_id(status.dsp_internal_id);
+        job->set_priority(task_priority_name(status.priority));
+        job->set_state(job_state_name(status.state));
+        job->set_chunks_total(status.chunks_total);
+        job->set_chunks_done(status.chunks_done);
+        job->set_chunks_skipped(status.chunks_skipped);
+        job->set_error(status.error);
+    }
+
+    response->mutable_status()->set_error(MoyoErrorCode::Success);
+    return Status::OK;
+}
+
+Status MoyoImpl::ltfBackgroundJobCancel(ServerContext* context,
+                                        const LtfBackgroundJobCancelRequest* request,
+                                        LtfBackgroundJobCancelResponse* response) {
+    LatencyScope latency(get_latency_stats(NODE_latency_stats_id)->histogram(
+        LatencyMetric::MoyoLtfBackgroundJobCancel));
+
+    if (!_task_scheduler.cancel(request->job_id())) {
+        response->mutable_status()->set_error(MoyoErrorCode::Failed);
+        response->mutable_status()->set_text("No such running background job");
+        return Status::OK;
+    }
+
+    response->mutable_status()->set_error(MoyoErrorCode::Success);
+    return Status::OK;
+}
+
+Status MoyoImpl::ltfContentionProfile(ServerContext* context,
+                                      const LtfContentionProfileRequest* request,
+                                      LtfContentionProfileResponse* response) {
+    LatencyScope latency(get_latency_stats(NODE_latency_stats_id)->histogram(
+        LatencyMetric::MoyoLtfContentionProfile));
+
+    if (request->mode() == LTF_PROFILING_ENABLE) {
+        u_prof_enable(true);
+    } else if (request->mode() == LTF_PROFILING_DISABLE) {
+        u_prof_enable(false);
+    }
+
+    UProfSortKey key = UProfSortKey::Cost;
+    switch (request->sort_by()) {
+    case LTF_PROFILE_SORT_WAIT:      key = UProfSortKey::Wait; break;
+    case LTF_PROFILE_SORT_CALLS:     key = UProfSortKey::Calls; break;
+    case LTF_PROFILE_SORT_CONTENDED: key = UProfSortKey::Contended; break;
+    default:                         break;
+    }
+
+    std::vector<UProfStats> stats = u_prof_snapshot();
+    u_prof_sort(stats, key);
+    if (request->limit() != 0 && stats.size() > request->limit()) {
+        stats.resize(request->limit());
+    }
+    for (const UProfStats& s : stats) {
+        LtfContentionProfileEntry* const entry = response->add_entries();
+        entry->set_name(s.name);
+        entry->set_kind(u_prof_kind_name(s.kind));
+        entry->set_calls(s.calls);
+        entry->set_total_ns(s.total_ns);
+        entry->set_wait_ns(s.wait_ns);
+        entry->set_contended(s.contended);
+    }
+
+    response->set_enabled(u_prof_enabled());
+    response->mutable_status()->set_error(MoyoErrorCode::Success);
+    return Status::OK;
+}
+
+Status MoyoImpl::ltfTraceConfigure(ServerContext* context,
+                                   const LtfTraceConfigureRequest* request,
+                                   LtfTraceConfigureResponse* response) {
+    LatencyScope latency(get_latency_stats(NODE_latency_stats_id)->histogram(
+        LatencyMetric::MoyoLtfTraceConfigure));
+
+    UTrConfig config;
+    for (const LtfTraceModuleConfig& m : request->modules()) {
+        if (m.module() >= static_cast<uint32_t>(U_TR_MAX_modules)) {
+            response->mutable_status()->set_error(MoyoErrorCode::Failed);
+            response->mutable_status()->set_text("Trace module out of range");
+            return Status::OK;
+        }
+        // LtfTraceLevel is the LogLevel plus one, with 0 for unchanged
+        config.modules.push_back({ static_cast<int>(m.module()),
+                                   static_cast<int>(m.level()) - 1,
+                                   m.debug_sample_period() });
+    }
+    switch (request->sink()) {
+    case LTF_TRACE_SINK_RING:     config.sink = UTrSinkKind::Ring; break;
+    case LTF_TRACE_SINK_FILE:     config.sink = UTrSinkKind::File; break;
+    case LTF_TRACE_SINK_RECORDER: config.sink = UTrSinkKind::Recorder; break;
+    default:                      break;
+    }
+    config.sink_path = request->sink_path();
+    if (request->adaptive() == LTF_TRACE_ADAPTIVE_ENABLE) {
+        config.adaptive = true;
+    } else if (request->adaptive() == LTF_TRACE_ADAPTIVE_DISABLE) {
+        config.adaptive = false;
+    }
+
+    const int err = u_tr_control().configure(config);
+    if (err != 0) {
+        response->mutable_status()->set_error(MoyoErrorCode::Failed);
+        response->mutable_status()->set_text(
+            err == EINVAL ? std::string("Invalid trace configuration")
+                          : "Error applying trace configuration due to error " +
+                                std::to_string(err));
+        return Status::OK;
+    }
+
+    const UTrControlStatus status = u_tr_control().status();
+    response->set_generation(status.generation);
+    response->set_sink(u_tr_sink_kind_name(status.sink));
+    response->set_sink_path(status.sink_path);
+    response->set_adaptive(status.adaptive);
+    response->set_debug_throttle_period(status.debug_throttle_period);
+    response->set_throttle_events(status.throttle_events);
+    response->set_throttle_reason(u_tr_throttle_reason_name(status.throttle_reason));
+    response->set_records_drained(status.records_drained);
+    response->set_records_lost(status.records_lost);
+    for (int module = 0; module < U_TR_MAX_modules; module++) {
+        const int level = u_tr_get_threshold(module);
+        const uint32_t period = u_tr_get_debug_sample_period(module);
+        if (level != U_TR_DEFAULT_threshold || period != 1) {
+            LtfTraceModuleConfig* const m = response->add_modules();
+            m->set_module(module);
+            m->set_level(static_cast<LtfTraceLevel>(level + 1));
+            m->set_debug_sample_period(period);
+        }
+    }
+
+    response->mutable_status()->set_error(MoyoErrorCode::Success);
+    return Status::OK;
+}
+
+DspLatencyStats* MoyoImpl::get_latency_stats(obj::DspInternalId dsp_internal_id) {
+    U_PROF_LOCK_GUARD(_latency_stats_mutex, "moyo.latency_stats_mutex");
+    std::unique_ptr<DspLatencyStats>& stats = _latency_stats[dsp_internal_id];
+    if (!stats) {
+        stats.reset(new DspLatencyStats());
+    }
+    return stats.get();
+}
+
+DspLatencyStats* MoyoImpl::find_latency_stats(obj::DspInternalId dsp_internal_id) {
+    U_PROF_LOCK_GUARD(_latency_stats_mutex, "moyo.latency_stats_mutex");
+    LatencyStatsMap::const_iterator it = _latency_stats.find(dsp_internal_id);
+    return it == _latency_stats.end() ? nullptr : it->second.get();
+}
+
 bool MoyoImpl::isValidFilePath(const std::string& file_path) {
     // Implement your file path validation logic here.
     // You might want to check if the path is valid, if the user has write permissions, etc.
@@ -89,6 +360,9 @@ bool MoyoImpl::isRecording(const std::string& file_path) {
 void MoyoImpl::startRecording(const std::string& file_path, float sampling_rate, int duration_seconds) {
     // Implement your logic to start recording traces to the specified file.
     // You might want to use a timer to stop the recording after the specified duration.
+
+    // Pin trace timestamps to wall time for this recording
+    u_tr_clock.calibrate();
 }
 
 } /* namespace writebuffer */
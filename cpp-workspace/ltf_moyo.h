@@ -7,8 +7,15 @@
 #ifndef LTF_MOYOS_H
 #define LTF_MOYOS_H
 
+#include <limits>
+#include <memory>
+#include <mutex>
+
+#include "ltf_latency_histogram.h"
+#include "ltf_task_scheduler.h"
 #include "pf_sub_ctrl.h"
 #include "u_grpc.h"
+#include "u_perfect_hash.h"
 #include "clustercfg_sub_ctrl_vector.h"
 #include "memcache_node.h"
 #include "wb_dsp_impl.h"
@@ -29,6 +36,17 @@ namespace ltf {
 class Superblock;
 class SuperblockManager;
 
+/**
+ * @brief Test Nvo Types
+ * @todo  Update when new types are supported
+ */
+inline constexpr auto test_nvo_types = u_make_perfect_hash_map<NvObjectType>({
+    { "Test1", NvObjectType::Test1 },
+    { "Test2", NvObjectType::Test2 },
+    { "Test3", NvObjectType::Test3 },
+    { "Test4", NvObjectType::Test4 }
+});
+
 /**
  * @class MoyoImpl
  *
@@ -55,7 +73,121 @@ public: /* RPC calls */
                                 const LtfTraceRecordEnableRequest* request, 
                                 LtfTraceRecordEnableResponse* response) override;
 
-   
+    /**
+     * @brief Return the latency histograms of a DSP as percentiles
+     *
+     * @param[in] context   Server context object
+     * @param[in] request   DSP internal id, percentiles and reset-on-read flag
+     * @param[out] response One entry per latency metric
+     * @return Status of the RPC call
+     */
+    Status ltfLatencyHistograms(ServerContext* context,
+                                const LtfLatencyHistogramsRequest* request,
+                                LtfLatencyHistogramsResponse* response) override;
+
+    /**
+     * @brief Write the trace ring and what is needed to decode it to a file,
+     *        from a background job
+     *
+     * @param[in] context   Server context object
+     * @param[in] request   File to write
+     * @param[out] response Status, the job writing the file and about how
+     *                      many records the ring held
+     * @return Status of the RPC call
+     */
+    Status ltfFlightRecorderSnapshot(ServerContext* context,
+                                     const LtfFlightRecorderSnapshotRequest* request,
+                                     LtfFlightRecorderSnapshotResponse* response) override;
+
+    /**
+     * @brief Report the progress of background jobs
+     *
+     * @param[in] context   Server context object
+     * @param[in] request   Job id, or 0 for all running and recent jobs
+     * @param[out] response One entry per job
+     * @return Status of the RPC call
+     */
+    Status ltfBackgroundJobs(ServerContext* context,
+                             const LtfBackgroundJobsRequest* request,
+                             LtfBackgroundJobsResponse* response) override;
+
+    /**
+     * @brief Cancel a background job
+     *
+     * @param[in] context   Server context object
+     * @param[in] request   Job id
+     * @param[out] response Status of the cancel request
+     * @return Status of the RPC call
+     */
+    Status ltfBackgroundJobCancel(ServerContext* context,
+                                  const LtfBackgroundJobCancelRequest* request,
+                                  LtfBackgroundJobCancelResponse* response) override;
+
+    /**
+     * @brief Return the contention profile: per trace site and named lock
+     *        call counts, time and lock wait time
+     *
+     * @param[in] context   Server context object
+     * @param[in] request   Sort key, entry limit and profiler on/off switch
+     * @param[out] response Entries, most expensive first
+     * @return Status of the RPC call
+     */
+    Status ltfContentionProfile(ServerContext* context,
+                                const LtfContentionProfileRequest* request,
+                                LtfContentionProfileResponse* response) override;
+
+    /**
+     * @brief Change per-module trace levels, debug sampling and the trace
+     *        sink, all or nothing, and report the trace configuration
+     *
+     * @param[in] context   Server context object
+     * @param[in] request   Module settings, sink and backpressure switch
+     * @param[out] response Configuration after the request, with backpressure state
+     * @return Status of the RPC call
+     */
+    Status ltfTraceConfigure(ServerContext* context,
+                             const LtfTraceConfigureRequest* request,
+                             LtfTraceConfigureResponse* response) override;
+
+public: /* Latency instrumentation */
+    /**
+     * @brief DSP internal id under which every moyo records its latency.
+     *        The moyo.* histograms of a DSP's id stay empty; query this id
+     *        for them. It is the largest id, which no DSP is given, so node
+     *        metrics neither mix into a DSP's report nor are reset with it.
+     */
+    static constexpr obj::DspInternalId NODE_latency_stats_id =
+        std::numeric_limits<obj::DspInternalId>::max();
+
+    /**
+     * @brief Get the latency histograms of a DSP, creating them on first use.
+     *        The commit, journal, recovery and copy-forward paths record into
+     *        these with a LatencyScope.
+     *
+     * @param[in] dsp_internal_id  The DSP internal id.
+     * @return The DSP's latency histograms; valid for the life of the service.
+     */
+    DspLatencyStats* get_latency_stats(obj::DspInternalId dsp_internal_id);
+
+    /**
+     * @brief Get the latency histograms of a DSP without creating them.
+     *
+     * @param[in] dsp_internal_id  The DSP internal id.
+     * @return The DSP's latency histograms, or nullptr if nothing has
+     *         recorded under @p dsp_internal_id yet.
+     */
+    DspLatencyStats* find_latency_stats(obj::DspInternalId dsp_internal_id);
+
+public: /* Background jobs */
+    /**
+     * @brief Executor for heavy moyo work. Journal dump, verification and
+     *        trace recording submit their work here as chunks per DSP and
+     *        segment range rather than running on the RPC thread.
+     *
+     * @return The scheduler; valid for the life of the service.
+     */
+    TaskScheduler& get_task_scheduler() { return _task_scheduler; }
+
 public: /* Moyo permittivity functions */
     /**
      * @brief Is the moyo permitted?
@@ -129,6 +261,18 @@ private: /* Data members */
      *        DSP creation.
      */
     std::atomic<obj::DspInternalId> _dsp_internal_id;
+
+    /** @brief Map to maintain DSP internal id to its latency histograms. */
+    typedef std::map<obj::DspInternalId, std::unique_ptr<DspLatencyStats>> LatencyStatsMap;
+
+    /** @brief Latency histograms, per DSP internal id. */
+    LatencyStatsMap _latency_stats;
+
+    /** @brief Protects _latency_stats; not taken when recording. */
+    std::mutex _latency_stats_mutex;
+
+    /** @brief Runs background jobs; last member, so it stops first. */
+    TaskScheduler _task_scheduler;
 }; /* class MoyoImpl */
 
 } /* namespace ltf */
@@ -0,0 +1,33 @@
+// Print the trace records of a flight recorder file, e.g. the one a
+// crashed process left behind. Usage: u_tr_dump <file>
+#include <cstdio>
+#include <cstring>
+
+#include "u_tr_recorder.h"
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        std::fprintf(stderr, "usage: %s <flight recorder file>\n", argv[0]);
+        return 2;
+    }
+    UTrRecorderImage image;
+    const int err = image.open(argv[1]);
+    if (err != 0) {
+        std::fprintf(stderr, "%s: %s\n", argv[1],
+                     err == EINVAL ? "not a flight recorder file" : std::strerror(err));
+        return 1;
+    }
+    const UTrRecorderHeader& header = image.header();
+    std::printf("# pid %lld, %llu records written, ring of %llu, %llu formats dropped\n",
+                static_cast<long long>(header.pid),
+                static_cast<unsigned long long>(image.ring().head()),
+                static_cast<unsigned long long>(header.ring_capacity),
+                static_cast<unsigned long long>(header.formats_dropped.load()));
+    uint64_t torn = 0;
+    image.dump(stdout, &torn);
+    if (torn != 0) {
+        std::printf("# %llu records were being written and are lost\n",
+                    static_cast<unsigned long long>(torn));
+    }
+    return 0;
+}
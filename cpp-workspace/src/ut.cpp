@@ -4,43 +4,9 @@
 #include <cstring>
 #include <source_location>
 
+#include "u_hash.h"
+#include "u_tr_level.h"
 
-class u_hash {
-private: // Constants
-    static const uint64_t FNV_prime = 1099511628211ULL;
-    static const uint64_t FNV_offset = 14695981039346656037ULL;
-public: // Constants
-    static const uint64_t initial = FNV_offset;
-public: // Methods:
-    // Hash a buffer of a given len.
-    // This function is additive, i.e., can be used like so:
-    //   uint64_t r;
-    //   r = hash(buf1, len1);   // Note: don't pass in an r==0, or else the
-    //                           //       hash of a buf of 0s will be a 0.
-    //                           //       You can pass u_hash::initial.
-    //   r = hash(buf2, len2, r);
-    //   r = hash(buf3, len3, r);
-    //   // etc.
-    //
-    static uint64_t
-    hash(const unsigned char* buf, size_t len, uint64_t r = initial)
-    {
-        while (len > 0) {
-            r ^= (uint64_t)*buf++;
-            r *= FNV_prime;
-            --len;
-        }
-        return r;
-    }
-    // Generalization: allow calls to hash() with objects of any type
-    template <typename T>
-    static uint64_t
-    hash(const T* buf, uint32_t count = 1, uint64_t r = initial)
-    {
-        return hash(reinterpret_cast<const unsigned char*>(buf), sizeof(T) * count, r);
-    }
-
-}; // u_hash
 
 template <size_t N>
 constexpr uint32_t compute_fnv_hash_of_label(const char (&str)[N]) {
@@ -77,8 +43,8 @@ struct UTtr {
 void
 u_tr_log(int module, int level, const char *func, const char *fmt, va_list ap)
 {
-    char buffer[1024]; // Adjust the size as needed
-    vsprintf(buffer, fmt, ap);
+    char buffer[1024]; // Longer messages are truncated
+    vsnprintf(buffer, sizeof(buffer), fmt, ap);
     std::cout << "In function: " << buffer << std::endl;
 }
 
@@ -95,25 +61,26 @@ u_tr_check(int module, int level, const char *func, const char *fmt, ...)
 }
 
 
+// Every macro below that issues a trace is gated by U_TR_GATED (see
+// u_tr_level.h): arguments are only evaluated once every gate passes.
 #define u_tr_mod(module, level, fmt, ...)                               \
-    do {                                                                \
-        u_tr_check((module), (level), __FUNCTION__, (fmt), ## __VA_ARGS__); \
-    } while (0)
+    U_TR_GATED((module), (level),                                       \
+               u_tr_check((module), (level), __FUNCTION__, (fmt), ## __VA_ARGS__))
 
 #define u_ntr_mod(module, level, fmt, ...)                      \
     u_tr_mod((module), (level), (fmt), ## __VA_ARGS__)
   
 
+// Ungated; only used behind the gate in u_ttr_detail_module
 #define u_ttr_st(module, level, ttr, fmt, ...)                          \
     do {                                                                \
-        u_ntr_mod(module, level, "%u" fmt, ttr.format_hash,## __VA_ARGS__);              \
+        u_tr_check((module), (level), __FUNCTION__, "%u" fmt, ttr.format_hash,## __VA_ARGS__); \
     } while (0)
 
 #define u_ttr_detail_module(module, level, arg_msg_limit, arg_time_interval, fmt, ...) \
-    do {                                                                               \
-        static UTtr ttr(arg_msg_limit, arg_time_interval, "" fmt);                        \
-        u_ttr_st(module, level, ttr, fmt, ## __VA_ARGS__);                             \
-    } while (0)
+    U_TR_GATED((module), (level),                                                      \
+               static UTtr ttr(arg_msg_limit, arg_time_interval, "" fmt);              \
+               u_ttr_st(module, level, ttr, fmt, ## __VA_ARGS__))
 
 #define U_TTR_DEFAULT_NUM_MSGS_BEFORE_QUIET  1000
 #define U_TTR_DEFAULT_TIME_INTERVAL          20.0
@@ -131,11 +98,11 @@ u_tr_check(int module, int level, const char *func, const char *fmt, ...)
 #define u_tr(level, fmt, ...)                                   \
     u_tr_module(__MODULE__, level, fmt, ## __VA_ARGS__)
 
-#define T_dbg 1
-    
 int main(){
      uint32_t ab = 10;
 
+      u_tr_set_threshold(__MODULE__, T_dbg);
+
       u_tr(T_dbg, "Starting writer thread %u", ab);
       u_tr(T_dbg, "1. Starting writer thread %u", ab);
       u_tr(T_dbg, "2. Starting writer thread %u", ab);
@@ -8,6 +8,8 @@
 #include "u_module.h"
 #define __MODULE__ MODULE_test
 
+#include <cmath>
+
 #include <gmock/gmock.h>
 
 #include "atm_storage_ary.h"
@@ -30,8 +32,11 @@
 #include "wb_superblock.h"
 #include "wb_types.h"
 #include "WbConfigData.h"
+#include "ltf_journal_space.h"
 #include "ltf_moyo.pb.h"
 #include "ltf_moyo.grpc.pb.h"
+#include "u_tr_control.h"
+#include "u_tr_recorder.h"
 
 
 using namespace ltf;
@@ -274,12 +279,22 @@ TestWbMoyos::fill_journal(std::vector<NvObjectBase*>* out_nvos,
     DspImpl* const dsp = get_dsp_impl();
 
     const size_t starting_nvo_count = out_nvos->size();
+    const size_t usage = dsp->get_segments_in_use();
+    const size_t free_segment_count = dsp->get_usable_segment_count() - usage;
     if (segment_count == 0) {
         /* Fill journal up to last usable segment */
-        const size_t usage = dsp->get_segments_in_use();
-        segment_count = dsp->get_usable_segment_count() - usage;
+        segment_count = free_segment_count;
     }
+    JournalSpaceReserver reserver(
+        dsp->get_journal_layout().data_capacity(free_segment_count));
     for (uint32_t index = 0; index < segment_count; index++) {
+        /* Size and reserve the transaction before building it */
+        TransactionFootprint footprint(dsp->get_journal_layout());
+        footprint.add_nvo(PAYLOAD_segment_size);
+        JournalSpaceReserver::Reservation reservation =
+            reserver.try_reserve(footprint.total_ondisk_size());
+        ASSERT_TRUE(reservation);
+
         TransactionPointer transaction = dsp->create_transaction(OWNER_wb);
         Payload<PAYLOAD_segment_size> payload;
         NvObjectBase* nvo =
@@ -296,9 +311,11 @@ TestWbMoyos::fill_journal(std::vector<NvObjectBase*>* out_nvos,
                                  &commit_op_status,
                                  &ondisk_usage);
         EXPECT_EQ(ondisk_usage, dsp->get_segment_size());
+        EXPECT_EQ(ondisk_usage, footprint.ondisk_usage());
 
-        /* Assume we won't exceed journal full when using this method */
+        /* The reservation guarantees we won't exceed journal full */
         EXPECT_TRUE(commit_op_status.get_and_clear());
+        reservation.commit();
     }
     const size_t ending_nvo_count = out_nvos->size();
     ASSERT_EQ(ending_nvo_count - starting_nvo_count, segment_count);
@@ -367,4 +384,329 @@ TEST_F(Phase0TestWbMoyos, journal_dump_target_free_space)
     EXPECT_EQ(response.status().error(), MoyoErrorCode::Failed);
     EXPECT_EQ(response.status().text(), "Error dumping journal due to error 28");
     tp_disable("writebuffer.dump_free_space_reserved");
-}
\ No newline at end of file
+}
+
+/*
+ * Records into a DSP's commit histogram and reads it back through the
+ * ltfLatencyHistograms moyo, checking that reset-on-read clears it.
+ */
+TEST_F(Phase0TestWbMoyos, latency_histograms_reset_on_read)
+{
+    const obj::DspInternalId dsp_internal_id = dsp_to_partition_id(get_dsp_id());
+    LatencyHistogram& commit =
+        moyo_service->get_latency_stats(dsp_internal_id)->histogram(LatencyMetric::Commit);
+    commit.snapshot(true);
+    commit.record(1000);
+    commit.record(2000);
+    commit.record(3000);
+
+    LtfLatencyHistogramsRequest request;
+    request.set_dsp_internal_id(dsp_internal_id);
+    request.add_percentiles(50.0);
+    request.set_reset(true);
+    LtfLatencyHistogramsResponse response;
+    Status rpc_status = moyo_service->ltfLatencyHistograms(&ctx, &request, &response);
+
+    EXPECT_TRUE(rpc_status.ok());
+    EXPECT_EQ(response.status().error(), MoyoErrorCode::Success);
+    ASSERT_EQ(response.histograms_size(), static_cast<int>(LatencyMetric::Count));
+    const LtfLatencyHistogram& histogram =
+        response.histograms(static_cast<int>(LatencyMetric::Commit));
+    EXPECT_EQ(histogram.name(), "commit");
+    EXPECT_EQ(histogram.count(), 3u);
+    EXPECT_EQ(histogram.max_ns(), 3000u);
+    ASSERT_EQ(histogram.percentiles_size(), 1);
+    EXPECT_GE(histogram.percentiles(0).value_ns(), 2000u);
+    EXPECT_LT(histogram.percentiles(0).value_ns(), 2200u);
+
+    response.Clear();
+    rpc_status = moyo_service->ltfLatencyHistograms(&ctx, &request, &response);
+    EXPECT_TRUE(rpc_status.ok());
+    EXPECT_EQ(response.histograms(static_cast<int>(LatencyMetric::Commit)).count(), 0u);
+}
+
+/*
+ * Asks ltfLatencyHistograms for an id nothing has recorded under; the moyo
+ * must fail without creating histograms for it.
+ */
+TEST_F(Phase0TestWbMoyos, latency_histograms_reject_unknown_dsp)
+{
+    const obj::DspInternalId unknown_id = 0xfffffff0;
+    ASSERT_EQ(moyo_service->find_latency_stats(unknown_id), nullptr);
+
+    LtfLatencyHistogramsRequest request;
+    request.set_dsp_internal_id(unknown_id);
+    LtfLatencyHistogramsResponse response;
+    Status rpc_status = moyo_service->ltfLatencyHistograms(&ctx, &request, &response);
+
+    EXPECT_TRUE(rpc_status.ok());
+    EXPECT_EQ(response.status().error(), MoyoErrorCode::Failed);
+    EXPECT_EQ(response.status().text(),
+              "No latency histograms for DSP internal id " + std::to_string(unknown_id));
+    EXPECT_EQ(response.histograms_size(), 0);
+    EXPECT_EQ(moyo_service->find_latency_stats(unknown_id), nullptr);
+
+    /* The node id always has them: this moyo records there */
+    EXPECT_NE(moyo_service->find_latency_stats(MoyoImpl::NODE_latency_stats_id), nullptr);
+}
+
+/*
+ * Asks ltfLatencyHistograms for percentiles outside [0, 100], NaN among
+ * them; the moyo must fail before reading any histogram.
+ */
+TEST_F(Phase0TestWbMoyos, latency_histograms_reject_bad_percentiles)
+{
+    const double bad_percentiles[] = { -1.0, 100.5, std::nan("") };
+    for (const double percentile : bad_percentiles) {
+        LtfLatencyHistogramsRequest request;
+        request.set_dsp_internal_id(MoyoImpl::NODE_latency_stats_id);
+        request.add_percentiles(percentile);
+        LtfLatencyHistogramsResponse response;
+        Status rpc_status = moyo_service->ltfLatencyHistograms(&ctx, &request, &response);
+
+        EXPECT_TRUE(rpc_status.ok());
+        EXPECT_EQ(response.status().error(), MoyoErrorCode::Failed);
+        EXPECT_EQ(response.status().text(), "Percentile out of range");
+        EXPECT_EQ(response.histograms_size(), 0);
+    }
+}
+
+/*
+ * Writes a trace through u_tr() and snapshots the trace ring through the
+ * ltfFlightRecorderSnapshot moyo, waiting for the job that writes the file;
+ * the file must decode without the process.
+ */
+TEST_F(Phase0TestWbMoyos, flight_recorder_snapshot_decodes)
+{
+    u_tr_control().set_trace_dir("/tmp");
+    const std::string file_name = "ltf_flight_recorder_snapshot." + std::to_string(getpid());
+    const std::string file_path = "/tmp/" + file_name;
+    u_tr(T_error, "moyo snapshot marker %d", 42);
+
+    LtfFlightRecorderSnapshotRequest request;
+    request.set_file_path(file_name);
+    LtfFlightRecorderSnapshotResponse response;
+    Status rpc_status = moyo_service->ltfFlightRecorderSnapshot(&ctx, &request, &response);
+
+    EXPECT_TRUE(rpc_status.ok());
+    EXPECT_EQ(response.status().error(), MoyoErrorCode::Success);
+    EXPECT_GT(response.record_count(), 0u);
+
+    TaskScheduler& scheduler = moyo_service->get_task_scheduler();
+    JobStatus status;
+    ASSERT_TRUE(scheduler.wait(response.job_id(), &status));
+    EXPECT_EQ(status.state, JobState::Done);
+    EXPECT_EQ(status.name, "flight_recorder_snapshot");
+    EXPECT_EQ(status.priority, TaskPriority::Diagnostic);
+
+    UTrRecorderImage image;
+    ASSERT_EQ(image.open(file_path.c_str()), 0);
+    EXPECT_GE(image.ring().head(), response.record_count());
+    unlink(file_path.c_str());
+
+    request.set_file_path("nonexistent/ltf_flight_recorder_snapshot");
+    response.Clear();
+    rpc_status = moyo_service->ltfFlightRecorderSnapshot(&ctx, &request, &response);
+    EXPECT_TRUE(rpc_status.ok());
+    EXPECT_EQ(response.status().error(), MoyoErrorCode::Success);
+    ASSERT_TRUE(scheduler.wait(response.job_id(), &status));
+    EXPECT_EQ(status.state, JobState::Failed);
+    EXPECT_EQ(status.error, ENOENT);
+
+    /* Nothing outside the trace directory, and no job for it */
+    for (const char* path : { "", "/etc/ltf_flight_recorder_snapshot", "../snapshot" }) {
+        request.set_file_path(path);
+        response.Clear();
+        rpc_status = moyo_service->ltfFlightRecorderSnapshot(&ctx, &request, &response);
+        EXPECT_TRUE(rpc_status.ok());
+        EXPECT_EQ(response.status().error(), MoyoErrorCode::Failed);
+        EXPECT_EQ(response.status().text(), "Invalid file path");
+        EXPECT_EQ(response.job_id(), 0u);
+    }
+    u_tr_control().set_trace_dir(UTrControl::DEFAULT_trace_dir);
+}
+
+/*
+ * Runs a chunked job on the moyo task scheduler, reports its progress
+ * through ltfBackgroundJobs and cancels it through ltfBackgroundJobCancel.
+ */
+TEST_F(Phase0TestWbMoyos, background_job_progress_and_cancel)
+{
+    const obj::DspInternalId dsp_internal_id = dsp_to_partition_id(get_dsp_id());
+    TaskScheduler& scheduler = moyo_service->get_task_scheduler();
+    std::atomic<bool> release(false);
+    std::atomic<uint32_t> started(0);
+    std::vector<TaskChunk> chunks = split_range(
+        0, scheduler.cpu_budget() + 8, 1, true,
+        [&](uint64_t, uint64_t, const TaskContext&) {
+            started++;
+            while (!release.load()) {
+                std::this_thread::yield();
+            }
+            return 0;
+        });
+    const uint64_t job_id = scheduler.submit("verify", dsp_internal_id,
+                                             TaskPriority::Diagnostic, std::move(chunks));
+    while (started.load() == 0) {
+        std::this_thread::yield();
+    }
+
+    LtfBackgroundJobsRequest request;
+    request.set_job_id(job_id);
+    LtfBackgroundJobsResponse response;
+    Status rpc_status = moyo_service->ltfBackgroundJobs(&ctx, &request, &response);
+    EXPECT_TRUE(rpc_status.ok());
+    EXPECT_EQ(response.status().error(), MoyoErrorCode::Success);
+    ASSERT_EQ(response.jobs_size(), 1);
+    EXPECT_EQ(response.jobs(0).name(), "verify");
+    EXPECT_EQ(response.jobs(0).dsp_internal_id(), dsp_internal_id);
+    EXPECT_EQ(response.jobs(0).priority(), "diagnostic");
+    EXPECT_EQ(response.jobs(0).state(), "running");
+    EXPECT_EQ(response.jobs(0).chunks_total(), scheduler.cpu_budget() + 8);
+
+    LtfBackgroundJobCancelRequest cancel_request;
+    cancel_request.set_job_id(job_id);
+    LtfBackgroundJobCancelResponse cancel_response;
+    rpc_status = moyo_service->ltfBackgroundJobCancel(&ctx, &cancel_request, &cancel_response);
+    EXPECT_TRUE(rpc_status.ok());
+    EXPECT_EQ(cancel_response.status().error(), MoyoErrorCode::Success);
+    release = true;
+
+    JobStatus status;
+    ASSERT_TRUE(scheduler.wait(job_id, &status));
+    EXPECT_EQ(status.state, JobState::Cancelled);
+    EXPECT_GT(status.chunks_skipped, 0u);
+
+    cancel_response.Clear();
+    rpc_status = moyo_service->ltfBackgroundJobCancel(&ctx, &cancel_request, &cancel_response);
+    EXPECT_TRUE(rpc_status.ok());
+    EXPECT_EQ(cancel_response.status().error(), MoyoErrorCode::Failed);
+    EXPECT_EQ(cancel_response.status().text(), "No such running background job");
+}
+
+/*
+ * Switches the contention profiler on through ltfContentionProfile, takes
+ * the moyo latency-stats lock and reads the profile back sorted by calls.
+ */
+TEST_F(Phase0TestWbMoyos, contention_profile_reports_named_locks)
+{
+    LtfContentionProfileRequest request;
+    request.set_mode(LTF_PROFILING_ENABLE);
+    LtfContentionProfileResponse response;
+    Status rpc_status = moyo_service->ltfContentionProfile(&ctx, &request, &response);
+    EXPECT_TRUE(rpc_status.ok());
+    EXPECT_TRUE(response.enabled());
+
+    for (int i = 0; i < 100; i++) {
+        moyo_service->get_latency_stats(dsp_to_partition_id(get_dsp_id()));
+    }
+
+    request.set_mode(LTF_PROFILING_DISABLE);
+    request.set_sort_by(LTF_PROFILE_SORT_CALLS);
+    response.Clear();
+    rpc_status = moyo_service->ltfContentionProfile(&ctx, &request, &response);
+    EXPECT_TRUE(rpc_status.ok());
+    EXPECT_EQ(response.status().error(), MoyoErrorCode::Success);
+    EXPECT_FALSE(response.enabled());
+
+    bool found = false;
+    for (int i = 0; i < response.entries_size(); i++) {
+        const LtfContentionProfileEntry& entry = response.entries(i);
+        if (i > 0) {
+            EXPECT_LE(entry.calls(), response.entries(i - 1).calls());
+        }
+        if (entry.name() == "moyo.latency_stats_mutex") {
+            EXPECT_EQ(entry.kind(), "lock");
+            EXPECT_GE(entry.calls(), 100u);
+            found = true;
+        }
+    }
+    EXPECT_TRUE(found);
+}
+
+/*
+ * Turns on sampled debug tracing of the writebuffer module with a file sink
+ * through ltfTraceConfigure, checks that a bad request changes nothing,
+ * and restores the defaults.
+ */
+TEST_F(Phase0TestWbMoyos, trace_configure_applies_all_or_nothing)
+{
+    u_tr_control().set_trace_dir("/tmp");
+    const std::string file_name = "ltf_trace_configure." + std::to_string(getpid());
+    LtfTraceConfigureRequest request;
+    LtfTraceModuleConfig* const module = request.add_modules();
+    module->set_module(MODULE_writebuffer);
+    module->set_level(LTF_TRACE_LEVEL_DBG);
+    module->set_debug_sample_period(4);
+    request.set_sink(LTF_TRACE_SINK_FILE);
+    request.set_sink_path(file_name);
+    LtfTraceConfigureResponse response;
+    Status rpc_status = moyo_service->ltfTraceConfigure(&ctx, &request, &response);
+
+    EXPECT_TRUE(rpc_status.ok());
+    EXPECT_EQ(response.status().error(), MoyoErrorCode::Success);
+    EXPECT_EQ(response.sink(), "file");
+    EXPECT_EQ(response.sink_path(), file_name);
+    EXPECT_TRUE(response.adaptive());
+    EXPECT_EQ(u_tr_get_threshold(MODULE_writebuffer), T_dbg);
+    EXPECT_EQ(u_tr_get_debug_sample_period(MODULE_writebuffer), 4u);
+    const uint64_t generation = response.generation();
+
+    bool found = false;
+    for (const LtfTraceModuleConfig& m : response.modules()) {
+        if (m.module() == MODULE_writebuffer) {
+            EXPECT_EQ(m.level(), LTF_TRACE_LEVEL_DBG);
+            EXPECT_EQ(m.debug_sample_period(), 4u);
+            found = true;
+        }
+    }
+    EXPECT_TRUE(found);
+
+    // A valid module next to a bad sink path: neither applies
+    module->set_level(LTF_TRACE_LEVEL_ERROR);
+    request.set_sink_path("nonexistent/ltf_trace_configure");
+    response.Clear();
+    rpc_status = moyo_service->ltfTraceConfigure(&ctx, &request, &response);
+    EXPECT_TRUE(rpc_status.ok());
+    EXPECT_EQ(response.status().error(), MoyoErrorCode::Failed);
+    EXPECT_EQ(response.status().text(), "Error applying trace configuration due to error 2");
+    EXPECT_EQ(u_tr_get_threshold(MODULE_writebuffer), T_dbg);
+
+    // Sink paths may not leave the trace directory
+    for (const char* path : { "/etc/ltf_trace_configure", "../ltf_trace_configure" }) {
+        request.set_sink_path(path);
+        response.Clear();
+        rpc_status = moyo_service->ltfTraceConfigure(&ctx, &request, &response);
+        EXPECT_EQ(response.status().error(), MoyoErrorCode::Failed);
+        EXPECT_EQ(response.status().text(), "Invalid trace configuration");
+        EXPECT_EQ(u_tr_get_threshold(MODULE_writebuffer), T_dbg);
+    }
+
+    request.Clear();
+    request.add_modules()->set_module(U_TR_MAX_modules);
+    response.Clear();
+    rpc_status = moyo_service->ltfTraceConfigure(&ctx, &request, &response);
+    EXPECT_EQ(response.status().error(), MoyoErrorCode::Failed);
+    EXPECT_EQ(response.status().text(), "Trace module out of range");
+
+    request.Clear();
+    LtfTraceModuleConfig* const restore = request.add_modules();
+    restore->set_module(MODULE_writebuffer);
+    restore->set_level(LTF_TRACE_LEVEL_INFO);
+    restore->set_debug_sample_period(1);
+    request.set_sink(LTF_TRACE_SINK_RING);
+    response.Clear();
+    rpc_status = moyo_service->ltfTraceConfigure(&ctx, &request, &response);
+    EXPECT_EQ(response.status().error(), MoyoErrorCode::Success);
+    EXPECT_EQ(response.sink(), "ring");
+    EXPECT_EQ(response.generation(), generation + 1);
+    EXPECT_EQ(u_tr_get_threshold(MODULE_writebuffer), U_TR_DEFAULT_threshold);
+    unlink(("/tmp/" + file_name).c_str());
+    u_tr_control().set_trace_dir(UTrControl::DEFAULT_trace_dir);
+}
+
+TEST_F(Phase0TestWbMoyos, nvo_type_table_resolves_names)
+{
+    EXPECT_EQ(test_nvo_types.find("Test3"), NvObjectType::Test3);
+    EXPECT_FALSE(test_nvo_types.contains("Test5"));
+}
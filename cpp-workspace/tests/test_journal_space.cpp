@@ -0,0 +1,195 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "ltf_journal_space.h"
+
+using ltf::JournalLayout;
+using ltf::JournalSpaceReserver;
+using ltf::TransactionFootprint;
+using ltf::TransactionPacker;
+
+namespace {
+
+constexpr uint32_t sector_size = 4096;
+constexpr uint32_t segment_size = 512 * 1024;
+
+constexpr JournalLayout test_layout = {
+    sector_size,    // sector_size
+    segment_size,   // segment_size
+    sector_size,    // segment_header_size
+    256,            // transaction_header_size
+    64,             // nvo_header_size
+};
+
+} // namespace
+
+TEST_CASE("segment sized transaction fills exactly one segment", "[journal]") {
+    // Same payload size test_ltf.moyo.cc uses to fill the journal
+    TransactionFootprint footprint(test_layout);
+    footprint.add_nvo(segment_size - 2 * sector_size);
+
+    REQUIRE(footprint.total_ondisk_nvo_header_size() == 64);
+    REQUIRE(footprint.padding_size() == sector_size - 256 - 64);
+    REQUIRE(footprint.segment_count() == 1);
+    REQUIRE(footprint.ondisk_usage() == segment_size);
+}
+
+TEST_CASE("transaction footprint pads to the sector size", "[journal]") {
+    TransactionFootprint footprint(test_layout);
+    for (int i = 0; i < 5; i++) {
+        footprint.add_nvo(100);
+    }
+
+    REQUIRE(footprint.nvo_count() == 5);
+    REQUIRE(footprint.payload_size() == 500);
+    REQUIRE(footprint.total_ondisk_size() == sector_size);
+    REQUIRE(footprint.padding_size() == sector_size - 256 - 5 * 64 - 500);
+}
+
+TEST_CASE("large transaction spans several segments", "[journal]") {
+    TransactionFootprint footprint(test_layout);
+    footprint.add_nvo(3 * segment_size);
+
+    REQUIRE(footprint.segment_count() == 4);
+    REQUIRE(footprint.ondisk_usage() ==
+            footprint.total_ondisk_size() + 4 * sector_size);
+}
+
+TEST_CASE("small transaction pays the header of its segment", "[journal]") {
+    TransactionFootprint footprint(test_layout);
+    footprint.add_nvo(4096);                    // 256 + 64 + 4096, padded to 8192
+
+    REQUIRE(footprint.total_ondisk_size() == 2 * sector_size);
+    REQUIRE(footprint.segment_count() == 1);
+    REQUIRE(footprint.ondisk_usage() == 3 * sector_size);
+}
+
+TEST_CASE("packed transactions share sectors", "[journal]") {
+    TransactionFootprint small(test_layout);
+    small.add_nvo(200);                         // 256 + 64 + 200 = 520 bytes
+
+    TransactionPacker packer(test_layout);
+    uint64_t offset = 0;
+    for (uint64_t i = 0; i < 7; i++) {
+        REQUIRE(packer.add(small, &offset));
+        REQUIRE(offset == i * 520);
+    }
+
+    // Seven 520 byte transactions fit in one sector instead of seven
+    REQUIRE(packer.transaction_count() == 7);
+    REQUIRE(packer.ondisk_size() == sector_size);
+    REQUIRE(packer.padding_size() == sector_size - 7 * 520);
+}
+
+TEST_CASE("packed group stops at the segment boundary", "[journal]") {
+    TransactionFootprint half(test_layout);
+    half.add_nvo(segment_size / 2);
+
+    TransactionPacker packer(test_layout);
+    uint64_t offset = 0;
+    REQUIRE(packer.add(half, &offset));
+    REQUIRE_FALSE(packer.add(half, &offset));
+    REQUIRE(packer.transaction_count() == 1);
+
+    packer.reset();
+    REQUIRE(packer.add(half, &offset));
+    REQUIRE(offset == 0);
+
+    // A transaction larger than a segment is accepted on its own
+    TransactionFootprint large(test_layout);
+    large.add_nvo(2 * segment_size);
+    packer.reset();
+    REQUIRE(packer.add(large, &offset));
+    REQUIRE(packer.ondisk_size() == large.total_ondisk_size());
+}
+
+TEST_CASE("try_reserve fails without blocking once the journal is full", "[journal]") {
+    JournalSpaceReserver reserver(2 * segment_size);
+
+    auto first = reserver.try_reserve(segment_size);
+    auto second = reserver.try_reserve(segment_size);
+    REQUIRE(first);
+    REQUIRE(second);
+    REQUIRE(reserver.available() == 0);
+
+    auto third = reserver.try_reserve(1);
+    REQUIRE_FALSE(third);
+
+    // Abandoning a reservation gives its space back; committing keeps it
+    first.reset();
+    REQUIRE(reserver.available() == segment_size);
+    second.commit();
+    REQUIRE(reserver.available() == segment_size);
+}
+
+TEST_CASE("reserver admits transactions until the journal is really full", "[journal]") {
+    constexpr uint32_t journal_segments = 64;
+    JournalSpaceReserver reserver(test_layout.data_capacity(journal_segments));
+
+    TransactionFootprint footprint(test_layout);
+    footprint.add_nvo(4096);
+
+    // Lay the transactions out back to back as the journal writes them and
+    // reserve each one before it goes in
+    const uint64_t data_size = test_layout.segment_data_size();
+    uint64_t written = 0;
+    uint32_t admitted = 0;
+    while (written + footprint.total_ondisk_size() <= data_size * journal_segments) {
+        auto reservation = reserver.try_reserve(footprint.total_ondisk_size());
+        REQUIRE(reservation);
+        reservation.commit();
+        written += footprint.total_ondisk_size();
+        admitted++;
+    }
+    const uint64_t segments_used = (written + data_size - 1) / data_size;
+    REQUIRE(segments_used == journal_segments);
+    REQUIRE(admitted == journal_segments * data_size / footprint.total_ondisk_size());
+
+    // The journal has no room for another one, and neither does the reserver
+    REQUIRE_FALSE(reserver.try_reserve(footprint.total_ondisk_size()));
+}
+
+TEST_CASE("reserve rejects requests larger than the journal", "[journal]") {
+    JournalSpaceReserver reserver(segment_size);
+    REQUIRE_FALSE(reserver.reserve(segment_size + 1));
+    REQUIRE(reserver.available() == segment_size);
+}
+
+TEST_CASE("reserve waits for released space", "[journal]") {
+    JournalSpaceReserver reserver(segment_size);
+    auto held = reserver.try_reserve(segment_size);
+    REQUIRE(held);
+
+    std::thread releaser([&] { held.reset(); });
+    auto waited = reserver.reserve(segment_size);
+    releaser.join();
+
+    REQUIRE(waited);
+    REQUIRE(waited.bytes() == segment_size);
+    REQUIRE(reserver.available() == 0);
+}
+
+TEST_CASE("blocked reservers are not missed by release", "[journal]") {
+    // The whole journal changes hands on every reservation, so each one but
+    // the first waits on a release; a lost wakeup hangs the test
+    JournalSpaceReserver reserver(segment_size);
+    std::atomic<int> failed{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 2000; i++) {
+                if (!reserver.reserve(segment_size)) {
+                    failed++;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(failed == 0);
+    REQUIRE(reserver.available() == segment_size);
+}
@@ -0,0 +1,71 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "ltf_latency_histogram.h"
+
+using ltf::LatencyHistogram;
+using ltf::LatencySnapshot;
+
+TEST_CASE("bucket bounds cover every value", "[latency]") {
+    const uint64_t values[] = { 0, 1, 15, 16, 17, 31, 32, 33, 1000, 123456789,
+                                (1ull << 40) - 1 };
+    for (uint64_t v : values) {
+        const uint32_t index = LatencyHistogram::bucket_index(v);
+        REQUIRE(index < LatencyHistogram::BUCKET_count);
+        REQUIRE(LatencyHistogram::bucket_upper_bound(index) >= v);
+        if (index > 0) {
+            REQUIRE(LatencyHistogram::bucket_upper_bound(index - 1) < v);
+        }
+    }
+    REQUIRE(LatencyHistogram::bucket_index(1ull << 50) == LatencyHistogram::BUCKET_count - 1);
+}
+
+TEST_CASE("percentiles are within bucket precision", "[latency]") {
+    auto histogram = std::make_unique<LatencyHistogram>();
+    for (uint64_t ns = 1; ns <= 10000; ns++) {
+        histogram->record(ns * 1000);
+    }
+
+    const LatencySnapshot snapshot = histogram->snapshot(false);
+    REQUIRE(snapshot.count == 10000);
+    REQUIRE(snapshot.max_ns == 10000000);
+
+    const uint64_t p50 = snapshot.percentile(50);
+    const uint64_t p99 = snapshot.percentile(99);
+    REQUIRE(p50 >= 5000000);
+    REQUIRE(p50 <= 5000000 * 107 / 100);
+    REQUIRE(p99 >= 9900000);
+    REQUIRE(p99 <= 10000000);
+    REQUIRE(snapshot.percentile(100) == 10000000);
+}
+
+TEST_CASE("reset on read clears the histogram", "[latency]") {
+    auto histogram = std::make_unique<LatencyHistogram>();
+    histogram->record(100);
+    histogram->record(200);
+
+    REQUIRE(histogram->snapshot(true).count == 2);
+    const LatencySnapshot after = histogram->snapshot(false);
+    REQUIRE(after.count == 0);
+    REQUIRE(after.max_ns == 0);
+    REQUIRE(after.percentile(50) == 0);
+}
+
+TEST_CASE("concurrent recorders are all counted", "[latency]") {
+    auto histogram = std::make_unique<LatencyHistogram>();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 10000; i++) {
+                histogram->record(i);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(histogram->snapshot(false).count == 40000);
+}
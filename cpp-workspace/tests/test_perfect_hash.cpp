@@ -0,0 +1,63 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "u_perfect_hash.h"
+
+namespace {
+
+enum class Fruit { Apple, Banana, Cherry, Damson };
+
+constexpr auto fruits = u_make_perfect_hash_map<Fruit>({
+    { "apple", Fruit::Apple },
+    { "banana", Fruit::Banana },
+    { "cherry", Fruit::Cherry },
+    { "damson", Fruit::Damson },
+});
+
+} // namespace
+
+TEST_CASE("perfect hash lookups resolve at compile time", "[perfect_hash]") {
+    STATIC_REQUIRE(fruits.size() == 4);
+    STATIC_REQUIRE(fruits.find("cherry") == Fruit::Cherry);
+    STATIC_REQUIRE_FALSE(fruits.find("durian").has_value());
+    STATIC_REQUIRE(fruits.name(Fruit::Banana) == "banana");
+}
+
+TEST_CASE("perfect hash finds every key and rejects near misses", "[perfect_hash]") {
+    for (const UPerfectHashEntry<Fruit>& entry : fruits) {
+        REQUIRE(fruits.find(std::string(entry.key)) == entry.value);
+    }
+    REQUIRE_FALSE(fruits.contains(""));
+    REQUIRE_FALSE(fruits.contains("Apple"));
+    REQUIRE_FALSE(fruits.contains("apples"));
+    REQUIRE_FALSE(fruits.contains("appl"));
+}
+
+TEST_CASE("perfect hash handles tables of many similar keys", "[perfect_hash]") {
+    // Keys that differ in one character stress the low bits of the hash
+    static constexpr auto fields = u_make_perfect_hash_map<int>({
+        { "FIELD_00", 0 },  { "FIELD_01", 1 },  { "FIELD_02", 2 },  { "FIELD_03", 3 },
+        { "FIELD_04", 4 },  { "FIELD_05", 5 },  { "FIELD_06", 6 },  { "FIELD_07", 7 },
+        { "FIELD_08", 8 },  { "FIELD_09", 9 },  { "FIELD_10", 10 }, { "FIELD_11", 11 },
+        { "FIELD_12", 12 }, { "FIELD_13", 13 }, { "FIELD_14", 14 }, { "FIELD_15", 15 },
+        { "FIELD_16", 16 }, { "FIELD_17", 17 }, { "FIELD_18", 18 }, { "FIELD_19", 19 },
+        { "FIELD_20", 20 }, { "FIELD_21", 21 }, { "FIELD_22", 22 }, { "FIELD_23", 23 },
+        { "FIELD_24", 24 }, { "FIELD_25", 25 }, { "FIELD_26", 26 }, { "FIELD_27", 27 },
+        { "FIELD_28", 28 }, { "FIELD_29", 29 }, { "FIELD_30", 30 }, { "FIELD_31", 31 },
+    });
+    STATIC_REQUIRE(decltype(fields)::TABLE_size == 128);
+
+    std::set<int> seen;
+    for (int i = 0; i < 32; i++) {
+        const std::string key = "FIELD_" + std::string(i < 10 ? "0" : "") + std::to_string(i);
+        const std::optional<int> value = fields.find(key);
+        REQUIRE(value == i);
+        seen.insert(*value);
+    }
+    REQUIRE(seen.size() == 32);
+    REQUIRE_FALSE(fields.contains("FIELD_32"));
+    REQUIRE_FALSE(fields.contains("FIELD_0"));
+}
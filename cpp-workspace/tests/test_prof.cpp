@@ -0,0 +1,154 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "u_prof.h"
+#include "u_tr.h"
+
+namespace {
+
+// Totals of the site named `name`; calls is 0 if it was never hit
+UProfStats find(const char *name) {
+    for (const UProfStats& s : u_prof_snapshot()) {
+        if (s.name == name) {
+            return s;
+        }
+    }
+    return UProfStats{};
+}
+
+// Profiling is process-wide; keep it on only for the test
+struct Profiling {
+    Profiling() { u_prof_enable(true); }
+    ~Profiling() { u_prof_enable(false); }
+};
+
+} // namespace
+
+TEST_CASE("sites with the same name and kind share counters", "[prof]") {
+    UProfSite a("test.shared", UProfKind::Scope);
+    UProfSite b("test.shared", UProfKind::Scope);
+    UProfSite lock("test.shared", UProfKind::Lock);
+    REQUIRE(a.index() == b.index());
+    REQUIRE(a.index() != lock.index());
+}
+
+TEST_CASE("scopes are counted across threads", "[prof]") {
+    Profiling profiling;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([] {
+            for (int i = 0; i < 100; i++) {
+                U_PROF_SCOPE("test.scope");
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    // Counts of threads that have exited are kept
+    const UProfStats s = find("test.scope");
+    REQUIRE(s.calls == 400);
+    REQUIRE(s.kind == UProfKind::Scope);
+    REQUIRE(s.wait_ns == 0);
+}
+
+TEST_CASE("contended locks record wait time", "[prof]") {
+    Profiling profiling;
+    std::mutex mutex;
+    std::thread holder;
+    {
+        U_PROF_LOCK_GUARD(mutex, "test.lock");
+        holder = std::thread([&mutex] {
+            U_PROF_LOCK_GUARD(mutex, "test.lock");
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    holder.join();
+
+    const UProfStats s = find("test.lock");
+    REQUIRE(s.kind == UProfKind::Lock);
+    REQUIRE(s.calls == 2);
+    REQUIRE(s.contended == 1);
+    REQUIRE(s.wait_ns >= 10000000);
+    REQUIRE(s.total_ns >= 10000000);
+}
+
+TEST_CASE("nothing is recorded while profiling is off", "[prof]") {
+    std::mutex mutex;
+    for (int i = 0; i < 10; i++) {
+        U_PROF_SCOPE("test.off.scope");
+        U_PROF_LOCK_GUARD(mutex, "test.off.lock");
+    }
+    REQUIRE(find("test.off.scope").calls == 0);
+    REQUIRE(find("test.off.lock").calls == 0);
+}
+
+TEST_CASE("literal trace sites are profiled by format", "[prof]") {
+    Profiling profiling;
+    for (int i = 0; i < 3; i++) {
+        u_tr(T_info, "profiled trace %d", i);
+    }
+    const UProfStats s = find("profiled trace %d");
+    REQUIRE(s.kind == UProfKind::TraceSite);
+    REQUIRE(s.calls == 3);
+}
+
+TEST_CASE("runtime trace formats are profiled apart", "[prof]") {
+    Profiling profiling;
+    FILE *const saved = u_tr_stream;
+    u_tr_stream = std::tmpfile();
+    // Same argument types, different formats, built where they do not
+    // outlive the call
+    for (int i = 0; i < 4; i++) {
+        u_tr(T_info, std::string(i < 3 ? "runtime first %d" : "runtime second %d").c_str(), i);
+    }
+
+    char line[256];
+    std::rewind(u_tr_stream);
+    std::vector<std::string> lines;
+    while (std::fgets(line, sizeof(line), u_tr_stream) != nullptr) {
+        lines.push_back(line);
+    }
+    std::fclose(u_tr_stream);
+    u_tr_stream = saved;
+
+    REQUIRE(find("runtime first %d").calls == 3);
+    REQUIRE(find("runtime second %d").calls == 1);
+    REQUIRE(lines.size() == 4);
+    REQUIRE(lines[3].find("runtime second 3") != std::string::npos);
+}
+
+TEST_CASE("runtime trace labels are kept past the caller's buffer", "[prof]") {
+    uint32_t index = 0;
+    {
+        std::string label = "test.runtime label";
+        UTtr ttr(1, 1.0, label.c_str());
+        index = ttr.site.index();
+        label.assign(label.size(), 'x');
+    }
+    UProfSite again("test.runtime label", UProfKind::TraceSite);
+    REQUIRE(again.index() == index);
+}
+
+TEST_CASE("profiles sort most expensive first", "[prof]") {
+    std::vector<UProfStats> stats(3);
+    stats[0].calls = 1; stats[0].total_ns = 10; stats[0].wait_ns = 500;
+    stats[1].calls = 9; stats[1].total_ns = 100;
+    stats[2].calls = 5; stats[2].total_ns = 200; stats[2].contended = 4; stats[2].wait_ns = 1;
+
+    u_prof_sort(stats, UProfSortKey::Cost);
+    REQUIRE(stats[0].cost_ns() == 510);
+    REQUIRE(stats[2].cost_ns() == 100);
+    u_prof_sort(stats, UProfSortKey::Calls);
+    REQUIRE(stats[0].calls == 9);
+    u_prof_sort(stats, UProfSortKey::Contended);
+    REQUIRE(stats[0].contended == 4);
+    u_prof_sort(stats, UProfSortKey::Wait);
+    REQUIRE(stats[0].wait_ns == 500);
+}
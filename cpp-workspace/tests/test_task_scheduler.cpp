@@ -0,0 +1,254 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <set>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "ltf_task_scheduler.h"
+
+using ltf::JobState;
+using ltf::JobStatus;
+using ltf::TaskChunk;
+using ltf::TaskContext;
+using ltf::TaskPriority;
+using ltf::TaskScheduler;
+
+namespace {
+
+// Chunk that blocks until `release` is set, so tests control what runs
+TaskChunk gate_chunk(std::atomic<bool>& release, std::atomic<uint32_t>& started) {
+    return { [&release, &started](const TaskContext&) {
+                started.fetch_add(1);
+                while (!release.load()) {
+                    std::this_thread::yield();
+                }
+                return 0;
+            } };
+}
+
+void wait_for(const std::atomic<uint32_t>& counter, uint32_t value) {
+    while (counter.load() < value) {
+        std::this_thread::yield();
+    }
+}
+
+} // namespace
+
+TEST_CASE("jobs split into ranges run every chunk once", "[scheduler]") {
+    TaskScheduler scheduler(4, 4, 4);
+    std::mutex mutex;
+    std::multiset<uint64_t> seen;
+    const uint64_t job = scheduler.submit(
+        "verify", 3, TaskPriority::Diagnostic,
+        ltf::split_range(0, 1000, 64, false, [&](uint64_t b, uint64_t e, const TaskContext&) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (uint64_t i = b; i < e; i++) {
+                seen.insert(i);
+            }
+            return 0;
+        }));
+
+    JobStatus status;
+    REQUIRE(scheduler.wait(job, &status));
+    REQUIRE(status.state == JobState::Done);
+    REQUIRE(status.dsp_internal_id == 3);
+    REQUIRE(status.chunks_total == 16);
+    REQUIRE(status.chunks_done == 16);
+    REQUIRE(seen.size() == 1000);
+    REQUIRE(*seen.begin() == 0);
+    REQUIRE(*seen.rbegin() == 999);
+}
+
+TEST_CASE("idle workers steal chunks of a busy worker", "[scheduler]") {
+    TaskScheduler scheduler(4, 4, 4);
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    std::atomic<uint32_t> running{0};
+
+    // Submitted from inside a worker, all chunks land on that worker's deque
+    const uint64_t outer = scheduler.submit("outer", 0, TaskPriority::Background,
+        { { [&](const TaskContext&) {
+            std::vector<TaskChunk> chunks;
+            for (int i = 0; i < 3; i++) {
+                chunks.push_back({ [&](const TaskContext&) {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        threads.insert(std::this_thread::get_id());
+                    }
+                    // Hold every chunk until all three run at once, on the
+                    // three workers other than this one
+                    running.fetch_add(1);
+                    wait_for(running, 3);
+                    return 0;
+                } });
+            }
+            const uint64_t inner = scheduler.submit("inner", 0, TaskPriority::Foreground,
+                                                    std::move(chunks));
+            JobStatus status;
+            scheduler.wait(inner, &status);
+            return 0;
+        } } });
+
+    JobStatus status;
+    REQUIRE(scheduler.wait(outer, &status));
+    REQUIRE(threads.size() == 3);
+}
+
+TEST_CASE("background work stays within the CPU budget", "[scheduler]") {
+    TaskScheduler scheduler(4, 2, 4);
+    std::atomic<bool> release{false};
+    std::atomic<uint32_t> started{0};
+    std::vector<TaskChunk> chunks;
+    for (int i = 0; i < 6; i++) {
+        chunks.push_back(gate_chunk(release, started));
+    }
+    const uint64_t diag = scheduler.submit("dump", 1, TaskPriority::Diagnostic, std::move(chunks));
+    wait_for(started, 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    REQUIRE(started.load() == 2);
+
+    // Foreground work still gets the remaining workers
+    std::atomic<uint32_t> foreground{0};
+    const uint64_t commit = scheduler.submit("commit", 1, TaskPriority::Foreground,
+        { { [&](const TaskContext&) { foreground.fetch_add(1); return 0; } } });
+    JobStatus status;
+    REQUIRE(scheduler.wait(commit, &status));
+    REQUIRE(foreground.load() == 1);
+
+    release.store(true);
+    REQUIRE(scheduler.wait(diag, &status));
+    REQUIRE(status.chunks_done == 6);
+}
+
+TEST_CASE("I/O chunks stay within the I/O budget", "[scheduler]") {
+    TaskScheduler scheduler(4, 4, 1);
+    std::atomic<uint32_t> in_flight{0};
+    std::atomic<uint32_t> most{0};
+    std::vector<TaskChunk> chunks;
+    for (int i = 0; i < 8; i++) {
+        chunks.push_back({ [&](const TaskContext&) {
+                              const uint32_t n = in_flight.fetch_add(1) + 1;
+                              uint32_t m = most.load();
+                              while (n > m && !most.compare_exchange_weak(m, n)) {
+                              }
+                              std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                              in_flight.fetch_sub(1);
+                              return 0;
+                          },
+                           true });
+    }
+    const uint64_t job = scheduler.submit("dump", 1, TaskPriority::Diagnostic, std::move(chunks));
+    JobStatus status;
+    REQUIRE(scheduler.wait(job, &status));
+    REQUIRE(status.chunks_done == 8);
+    REQUIRE(most.load() == 1);
+}
+
+TEST_CASE("higher priority classes run first", "[scheduler]") {
+    TaskScheduler scheduler(1, 1, 1);
+    std::atomic<bool> release{false};
+    std::atomic<uint32_t> started{0};
+    const uint64_t blocker = scheduler.submit("blocker", 0, TaskPriority::Foreground,
+                                              { gate_chunk(release, started) });
+    wait_for(started, 1);
+
+    std::mutex mutex;
+    std::vector<TaskPriority> order;
+    auto record = [&](TaskPriority priority) {
+        return TaskChunk{ [&, priority](const TaskContext&) {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(priority);
+            return 0;
+        } };
+    };
+    const uint64_t diag = scheduler.submit("diag", 0, TaskPriority::Diagnostic,
+                                           { record(TaskPriority::Diagnostic) });
+    scheduler.submit("bg", 0, TaskPriority::Background, { record(TaskPriority::Background) });
+    const uint64_t last = scheduler.submit("fg", 0, TaskPriority::Foreground,
+                                           { record(TaskPriority::Foreground) });
+    release.store(true);
+
+    JobStatus status;
+    REQUIRE(scheduler.wait(blocker, &status));
+    REQUIRE(scheduler.wait(last, &status));
+    REQUIRE(scheduler.wait(diag, &status));
+    std::lock_guard<std::mutex> lock(mutex);
+    REQUIRE(order == std::vector<TaskPriority>{ TaskPriority::Foreground, TaskPriority::Background,
+                                               TaskPriority::Diagnostic });
+}
+
+TEST_CASE("cancelled jobs skip their queued chunks", "[scheduler]") {
+    TaskScheduler scheduler(1, 1, 1);
+    std::atomic<bool> release{false};
+    std::atomic<uint32_t> started{0};
+    std::vector<TaskChunk> chunks;
+    for (int i = 0; i < 5; i++) {
+        chunks.push_back(gate_chunk(release, started));
+    }
+    const uint64_t job = scheduler.submit("verify", 2, TaskPriority::Diagnostic, std::move(chunks));
+    wait_for(started, 1);
+
+    JobStatus status;
+    REQUIRE(scheduler.status(job, &status));
+    REQUIRE(status.state == JobState::Running);
+    REQUIRE(scheduler.cancel(job));
+    release.store(true);
+
+    REQUIRE(scheduler.wait(job, &status));
+    REQUIRE(status.state == JobState::Cancelled);
+    REQUIRE(status.chunks_done == 1);
+    REQUIRE(status.chunks_skipped == 4);
+    REQUIRE_FALSE(scheduler.cancel(job));
+    REQUIRE_FALSE(scheduler.status(job + 100, &status));
+}
+
+TEST_CASE("a failing chunk fails the job", "[scheduler]") {
+    TaskScheduler scheduler(1, 1, 1);
+    std::vector<TaskChunk> chunks;
+    chunks.push_back({ [](const TaskContext&) { return 5; } });
+    chunks.push_back({ [](const TaskContext&) { return 0; } });
+    const uint64_t job = scheduler.submit("dump", 0, TaskPriority::Diagnostic, std::move(chunks));
+
+    JobStatus status;
+    REQUIRE(scheduler.wait(job, &status));
+    REQUIRE(status.state == JobState::Failed);
+    REQUIRE(status.error == 5);
+    REQUIRE(status.chunks_done + status.chunks_skipped == 2);
+}
+
+TEST_CASE("a throwing chunk fails the job", "[scheduler]") {
+    TaskScheduler scheduler(1, 1, 1);
+    const auto fails_with = [&](std::function<int(const TaskContext&)> run) {
+        std::vector<TaskChunk> chunks;
+        chunks.push_back({ std::move(run) });
+        chunks.push_back({ [](const TaskContext&) { return 0; } });
+        JobStatus status;
+        REQUIRE(scheduler.wait(scheduler.submit("dump", 0, TaskPriority::Diagnostic,
+                                                std::move(chunks)),
+                               &status));
+        REQUIRE(status.state == JobState::Failed);
+        REQUIRE(status.chunks_done + status.chunks_skipped == 2);
+        return status.error;
+    };
+
+    REQUIRE(fails_with([](const TaskContext&) -> int { throw std::bad_alloc(); }) == ENOMEM);
+    REQUIRE(fails_with([](const TaskContext&) -> int {
+        throw std::system_error(ENOSPC, std::generic_category());
+    }) == ENOSPC);
+    REQUIRE(fails_with([](const TaskContext&) -> int { throw 42; }) == EIO);
+
+    // The worker survived and still runs jobs
+    std::vector<TaskChunk> chunks;
+    chunks.push_back({ [](const TaskContext&) { return 0; } });
+    JobStatus status;
+    REQUIRE(scheduler.wait(scheduler.submit("dump", 0, TaskPriority::Diagnostic, std::move(chunks)),
+                           &status));
+    REQUIRE(status.state == JobState::Done);
+}
@@ -0,0 +1,73 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "u_tr_clock.h"
+
+namespace {
+
+int64_t realtime_now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+} // namespace
+
+TEST_CASE("stamps decode to wall time", "[trace]") {
+    UTrClock clock;
+    clock.calibrate(2000000);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    const int64_t before = realtime_now_ns();
+    const UTrStamp stamp = clock.stamp();
+    const int64_t after = realtime_now_ns();
+
+    uint64_t ticks = 0;
+    REQUIRE(clock.ticks_of(stamp, &ticks));
+    const int64_t decoded = clock.realtime_ns(ticks);
+    // Calibration error over a few milliseconds is far below this bound
+    REQUIRE(decoded >= before - 1000000);
+    REQUIRE(decoded <= after + 1000000);
+}
+
+TEST_CASE("stamps are ordered across threads", "[trace]") {
+    UTrClock clock;
+    UTrStamp first = clock.stamp();
+    UTrStamp second;
+    std::thread other([&] { second = clock.stamp(); });
+    other.join();
+
+    uint64_t t1, t2;
+    REQUIRE(clock.ticks_of(first, &t1));
+    REQUIRE(clock.ticks_of(second, &t2));
+    REQUIRE(t1 < t2);
+    REQUIRE(clock.monotonic_ns(t1) <= clock.monotonic_ns(t2));
+}
+
+TEST_CASE("calibration is published whole while readers decode", "[trace]") {
+    UTrClock clock;
+    std::atomic<bool> done{false};
+    std::thread calibrator([&] {
+        for (int i = 0; i < 20; i++) {
+            clock.calibrate(100000);
+        }
+        done.store(true);
+    });
+
+    // Each calibration pins a later instant than the one before it
+    int64_t last_monotonic_ns0 = 0;
+    uint64_t last_ticks0 = 0;
+    while (!done.load()) {
+        const UTrClock::Calibration c = clock.calibration();
+        REQUIRE(c.ns_per_tick > 0);
+        REQUIRE(c.monotonic_ns0 >= last_monotonic_ns0);
+        REQUIRE(c.ticks0 >= last_ticks0);
+        REQUIRE((c.monotonic_ns0 > last_monotonic_ns0) == (c.ticks0 > last_ticks0));
+        last_monotonic_ns0 = c.monotonic_ns0;
+        last_ticks0 = c.ticks0;
+    }
+    calibrator.join();
+}
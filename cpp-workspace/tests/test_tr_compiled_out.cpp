@@ -0,0 +1,57 @@
+// Built with -DU_TR_MIN_LEVEL=1 -DU_TR_DISABLED_MODULES=17,42 (see
+// CMakeLists.txt), so some sites below are compiled out.
+#include <catch2/catch_test_macros.hpp>
+
+#include <string>
+
+#include "u_tr.h"
+
+static_assert(U_TR_MIN_LEVEL == 1, "build this file with -DU_TR_MIN_LEVEL=1");
+
+TEST_CASE("the build masks come from the command line", "[trace]") {
+    STATIC_REQUIRE_FALSE(u_tr_compiled_in(3, T_dbg));
+    STATIC_REQUIRE(u_tr_compiled_in(3, T_info));
+    STATIC_REQUIRE_FALSE(u_tr_compiled_in(17, T_error));
+    STATIC_REQUIRE_FALSE(u_tr_compiled_in(42, T_info));
+    STATIC_REQUIRE(u_tr_compiled_in(43, T_info));
+}
+
+TEST_CASE("compiled out sites never evaluate their arguments", "[trace]") {
+    // Open the runtime gates, so only the compile-time mask can stop a site
+    u_tr_set_threshold(3, T_dbg);
+    u_tr_set_threshold(17, T_dbg);
+    u_tr_set_threshold(42, T_dbg);
+    const uint64_t head = u_tr_ring.head();
+    int evaluated = 0;
+
+    u_tr_mod(3, T_dbg, "below the level %d", ++evaluated);
+    u_tr_mod(17, T_error, "disabled module %d", ++evaluated);
+    u_tr_mod(42, T_info, "disabled module %d", ++evaluated);
+    REQUIRE(evaluated == 0);
+    REQUIRE(u_tr_ring.head() == head);
+
+    u_tr_mod(3, T_info, "compiled in %d", ++evaluated);
+    REQUIRE(evaluated == 1);
+    REQUIRE(u_tr_ring.head() == head + 1);
+
+    UTrRecord record;
+    REQUIRE(u_tr_ring.read(head, &record));
+    REQUIRE(record.module == 3);
+    char text[64];
+    REQUIRE(u_tr_decode(record, text, sizeof(text)) >= 0);
+    REQUIRE(std::string(text) == "compiled in 1");
+
+    u_tr_set_threshold(3, U_TR_DEFAULT_threshold);
+    u_tr_set_threshold(17, U_TR_DEFAULT_threshold);
+    u_tr_set_threshold(42, U_TR_DEFAULT_threshold);
+}
+
+TEST_CASE("compiled in sites still pass the runtime threshold", "[trace]") {
+    const uint64_t head = u_tr_ring.head();
+    int evaluated = 0;
+    u_tr_set_threshold(43, T_warn);
+    u_tr_mod(43, T_info, "below the threshold %d", ++evaluated);
+    REQUIRE(evaluated == 0);
+    REQUIRE(u_tr_ring.head() == head);
+    u_tr_set_threshold(43, U_TR_DEFAULT_threshold);
+}
@@ -0,0 +1,261 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "u_tr_control.h"
+
+namespace {
+
+// Sink paths are relative to the trace directory the tests use
+constexpr const char *TRACE_dir = "/tmp";
+
+std::string temp_name(const char *name) {
+    return std::string(name) + "." + std::to_string(getpid());
+}
+
+std::string in_trace_dir(const std::string& name) {
+    return std::string(TRACE_dir) + "/" + name;
+}
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path);
+    std::stringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+// Only drain_once() drains, so tests decide when passes happen
+constexpr std::chrono::milliseconds MANUAL_drain{std::chrono::hours(1)};
+
+} // namespace
+
+TEST_CASE("backpressure doubles the debug sample period and recovers", "[trace]") {
+    UTrBackpressure backpressure;
+    const uint64_t capacity = 1024;
+
+    REQUIRE(backpressure.observe({ 100, 0, 10, capacity, 1000 }) == 0);
+    REQUIRE(backpressure.observe({ 100, 5, 10, capacity, 1000 }) == 1);
+    REQUIRE(backpressure.reason() == UTrThrottleReason::RecordsLost);
+    REQUIRE(backpressure.observe({ 100, 0, 900, capacity, 1000 }) == 2);
+    REQUIRE(backpressure.reason() == UTrThrottleReason::Backlog);
+    REQUIRE(backpressure.observe({ 100, 0, 10, capacity, UTrBackpressure::MAX_write_ns + 1 }) == 3);
+    REQUIRE(backpressure.reason() == UTrThrottleReason::WriteLatency);
+    REQUIRE(backpressure.events() == 3);
+
+    // Passes between the limits hold the throttle however many there are
+    for (uint32_t i = 0; i < 2 * UTrBackpressure::RECOVER_passes; i++) {
+        REQUIRE(backpressure.observe({ 100, 0, 300, capacity, 1000 }) == 3);
+    }
+    for (uint32_t i = 1; i < UTrBackpressure::RECOVER_passes; i++) {
+        REQUIRE(backpressure.observe({ 100, 0, 10, capacity, 1000 }) == 3);
+    }
+    REQUIRE(backpressure.observe({ 100, 0, 10, capacity, 1000 }) == 2);
+    REQUIRE(backpressure.reason() == UTrThrottleReason::Recovered);
+
+    for (int i = 0; i < 2 * UTrBackpressure::MAX_throttle; i++) {
+        backpressure.observe({ 100, 1, 10, capacity, 1000 });
+    }
+    REQUIRE(backpressure.shift() == UTrBackpressure::MAX_throttle);
+}
+
+TEST_CASE("debug traces are sampled by module period and throttle", "[trace]") {
+    constexpr int module = 9;
+    auto kept = [](int level) {
+        int n = 0;
+        for (int i = 0; i < 1024; i++) {
+            n += u_tr_sampled(module, level);
+        }
+        return n;
+    };
+    REQUIRE(kept(T_dbg) == 1024);
+
+    u_tr_set_debug_sample_period(module, 3);
+    REQUIRE(u_tr_get_debug_sample_period(module) == 4);
+    REQUIRE(kept(T_dbg) == 256);
+    REQUIRE(kept(T_info) == 1024);
+
+    u_tr_set_debug_throttle(2);
+    REQUIRE(kept(T_dbg) == 64);
+    REQUIRE(kept(T_error) == 1024);
+
+    u_tr_set_debug_throttle(0);
+    u_tr_set_debug_sample_period(module, 1);
+    REQUIRE(kept(T_dbg) == 1024);
+}
+
+TEST_CASE("configure applies all or nothing", "[trace]") {
+    constexpr int module = 5;
+    UTrControl control(MANUAL_drain, TRACE_dir);
+
+    UTrConfig config;
+    config.modules.push_back({ module, T_dbg, 8 });
+    config.modules.push_back({ U_TR_MAX_modules, T_dbg, 0 });
+    REQUIRE(control.configure(config) == EINVAL);
+    REQUIRE(u_tr_get_threshold(module) == U_TR_DEFAULT_threshold);
+
+    config.modules.pop_back();
+    config.sink = UTrSinkKind::File;
+    config.sink_path = "nonexistent/u_tr_control";
+    REQUIRE(control.configure(config) == ENOENT);
+    REQUIRE(u_tr_get_threshold(module) == U_TR_DEFAULT_threshold);
+    REQUIRE(u_tr_get_debug_sample_period(module) == 1);
+    REQUIRE(control.status().generation == 0);
+    REQUIRE(control.status().sink == UTrSinkKind::Ring);
+
+    config.sink.reset();
+    REQUIRE(control.configure(config) == 0);
+    REQUIRE(u_tr_get_threshold(module) == T_dbg);
+    REQUIRE(u_tr_get_debug_sample_period(module) == 8);
+    REQUIRE(control.status().generation == 1);
+
+    config.modules = { { module, U_TR_DEFAULT_threshold, 1 } };
+    REQUIRE(control.configure(config) == 0);
+    REQUIRE(u_tr_get_threshold(module) == U_TR_DEFAULT_threshold);
+}
+
+TEST_CASE("sink paths must stay inside the trace directory", "[trace]") {
+    UTrControl control(MANUAL_drain, TRACE_dir);
+    UTrConfig config;
+    config.modules.push_back({ 6, T_dbg, 0 });
+    for (UTrSinkKind kind : { UTrSinkKind::File, UTrSinkKind::Recorder }) {
+        config.sink = kind;
+        for (const char *path : { "/tmp/u_tr_control", "../u_tr_control", "a/../../u_tr_control",
+                                  ".." }) {
+            config.sink_path = path;
+            REQUIRE(control.configure(config) == EINVAL);
+        }
+    }
+    REQUIRE(u_tr_get_threshold(6) == U_TR_DEFAULT_threshold);
+    REQUIRE(control.status().generation == 0);
+    REQUIRE(control.trace_dir() == TRACE_dir);
+
+    // Other files written on request resolve the same way
+    std::string resolved;
+    REQUIRE(control.trace_file_path("snap/shot", &resolved));
+    REQUIRE(resolved == in_trace_dir("snap/shot"));
+    for (const char *path : { "", "/tmp/snapshot", "../snapshot", "snap/../../shot" }) {
+        REQUIRE_FALSE(control.trace_file_path(path, &resolved));
+    }
+}
+
+TEST_CASE("file sink prints records and throttles when it falls behind", "[trace]") {
+    const std::string name = temp_name("u_tr_control");
+    const std::string path = in_trace_dir(name);
+    unlink(path.c_str());
+    UTrControl control(MANUAL_drain, TRACE_dir);
+
+    UTrConfig config;
+    config.sink = UTrSinkKind::File;
+    config.sink_path = name;
+    REQUIRE(control.configure(config) == 0);
+    REQUIRE(control.status().sink == UTrSinkKind::File);
+    REQUIRE(control.status().sink_path == name);
+
+    UTrDrainPass pass;
+    REQUIRE(control.drain_once(&pass));
+    for (int i = 0; i < 10; i++) {
+        u_tr(T_info, "file sink %d", i);
+    }
+    REQUIRE(control.drain_once(&pass));
+    REQUIRE(pass.records == 10);
+    REQUIRE(pass.lost == 0);
+    REQUIRE(read_file(path).find("file sink 9") != std::string::npos);
+
+    // Lap the drain: the records it never saw halve T_dbg sampling
+    for (uint64_t i = 0; i < u_tr_ring.capacity() + 10; i++) {
+        u_tr(T_info, "flood %llu", static_cast<unsigned long long>(i));
+    }
+    REQUIRE(control.drain_once(&pass));
+    REQUIRE(pass.lost >= 10);
+    UTrControlStatus status = control.status();
+    REQUIRE(status.debug_throttle_period == 2);
+    REQUIRE(status.throttle_reason == UTrThrottleReason::RecordsLost);
+    REQUIRE(status.records_lost == pass.lost);
+    REQUIRE(u_tr_get_debug_throttle() == 1);
+
+    for (uint32_t i = 0; i < UTrBackpressure::RECOVER_passes; i++) {
+        REQUIRE(control.drain_once(&pass));
+    }
+    status = control.status();
+    REQUIRE(status.debug_throttle_period == 1);
+    REQUIRE(status.throttle_events == 2);
+    REQUIRE(u_tr_get_debug_throttle() == 0);
+    REQUIRE(read_file(path).find("keeping 1 in 2 T_dbg traces (records_lost)") != std::string::npos);
+
+    config.sink = UTrSinkKind::Ring;
+    REQUIRE(control.configure(config) == 0);
+    REQUIRE_FALSE(control.drain_once(&pass));
+    REQUIRE(control.status().sink == UTrSinkKind::Ring);
+    unlink(path.c_str());
+}
+
+TEST_CASE("recorder sink switches the active ring both ways", "[trace]") {
+    const std::string name = temp_name("u_tr_control_recorder");
+    const std::string path = in_trace_dir(name);
+    // A process opens one recorder for good, so do it in a child
+    const pid_t child = fork();
+    REQUIRE(child >= 0);
+    if (child == 0) {
+        UTrControl control(MANUAL_drain, TRACE_dir);
+        UTrConfig config;
+        config.sink = UTrSinkKind::Recorder;
+        bool ok = control.configure(config) == EINVAL;
+        config.sink_path = name;
+        ok = ok && control.configure(config) == 0;
+        UTrRing *const recorder = u_tr_active_ring.load();
+        ok = ok && recorder != &u_tr_ring;
+        u_tr(T_info, "in the recorder %d", 1);
+        ok = ok && control.configure(config) == EALREADY;
+
+        config.sink = UTrSinkKind::Ring;
+        ok = ok && control.configure(config) == 0 && u_tr_active_ring.load() == &u_tr_ring;
+        u_tr(T_info, "back in the ring %d", 2);
+
+        config.sink = UTrSinkKind::Recorder;
+        config.sink_path.clear();
+        ok = ok && control.configure(config) == 0 && u_tr_active_ring.load() == recorder;
+        ok = ok && control.status().sink_path == name;
+        _exit(ok ? 0 : 1);
+    }
+    int status;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+
+    UTrRecorderImage image;
+    REQUIRE(image.open(path.c_str()) == 0);
+    // Records written while the ring was active were carried back
+    REQUIRE(image.ring().head() >= 2);
+    unlink(path.c_str());
+}
+
+TEST_CASE("a created recorder takes over only when the sink switches", "[trace]") {
+    const std::string name = temp_name("u_tr_control_created");
+    const std::string path = in_trace_dir(name);
+    const pid_t child = fork();
+    REQUIRE(child >= 0);
+    if (child == 0) {
+        bool ok = u_tr_flight_recorder_create(path.c_str(), 1024) == 0;
+        ok = ok && u_tr_active_ring.load() == &u_tr_ring;
+        ok = ok && u_tr_flight_recorder_create(path.c_str(), 1024) == EALREADY;
+
+        UTrControl control(MANUAL_drain, TRACE_dir);
+        UTrConfig config;
+        config.sink = UTrSinkKind::Recorder;
+        ok = ok && control.configure(config) == 0;
+        ok = ok && u_tr_active_ring.load() == &u_tr_flight_recorder->ring();
+        _exit(ok ? 0 : 1);
+    }
+    int status;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+    unlink(path.c_str());
+}
@@ -0,0 +1,121 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "u_tr.h"
+
+namespace {
+
+constexpr UTrFormatSpec spec = u_tr_parse_format("%d %5.2f %-8s %llx %p %% %c");
+
+// Decode the last record u_tr() wrote
+std::string last_trace() {
+    UTrRecord record;
+    REQUIRE(u_tr_ring.read(u_tr_ring.head() - 1, &record));
+    char text[256];
+    REQUIRE(u_tr_decode(record, text, sizeof(text)) >= 0);
+    return text;
+}
+
+} // namespace
+
+TEST_CASE("formats are parsed at compile time", "[trace]") {
+    STATIC_REQUIRE(spec.valid);
+    STATIC_REQUIRE(spec.count == 6);
+    STATIC_REQUIRE(spec.conv[0].kind == UTrArgKind::Int);
+    STATIC_REQUIRE(spec.conv[1].kind == UTrArgKind::Double);
+    STATIC_REQUIRE(spec.conv[2].kind == UTrArgKind::String);
+    STATIC_REQUIRE(spec.conv[3].size == sizeof(long long));
+    STATIC_REQUIRE(spec.conv[4].kind == UTrArgKind::Pointer);
+    STATIC_REQUIRE(spec.conv[5].kind == UTrArgKind::Char);
+
+    STATIC_REQUIRE_FALSE(u_tr_parse_format("%*d").valid);
+    STATIC_REQUIRE_FALSE(u_tr_parse_format("%n").valid);
+    STATIC_REQUIRE_FALSE(u_tr_parse_format("%Lf").valid);
+    STATIC_REQUIRE_FALSE(u_tr_parse_format("trailing %").valid);
+}
+
+TEST_CASE("argument types are checked against conversions", "[trace]") {
+    STATIC_REQUIRE(u_tr_compatible(spec.conv[0], u_tr_arg_conversion<int>()));
+    STATIC_REQUIRE(u_tr_compatible(spec.conv[0], u_tr_arg_conversion<uint32_t>()));
+    STATIC_REQUIRE(u_tr_compatible(spec.conv[0], u_tr_arg_conversion<short>()));
+    STATIC_REQUIRE_FALSE(u_tr_compatible(spec.conv[0], u_tr_arg_conversion<int64_t>()));
+    STATIC_REQUIRE_FALSE(u_tr_compatible(spec.conv[0], u_tr_arg_conversion<double>()));
+    STATIC_REQUIRE(u_tr_compatible(spec.conv[1], u_tr_arg_conversion<float>()));
+    STATIC_REQUIRE_FALSE(u_tr_compatible(spec.conv[2], u_tr_arg_conversion<int>()));
+    STATIC_REQUIRE(u_tr_compatible(spec.conv[2], u_tr_arg_conversion<const char (&)[4]>()));
+    STATIC_REQUIRE(u_tr_compatible(spec.conv[4], u_tr_arg_conversion<int *>()));
+    STATIC_REQUIRE_FALSE(u_tr_compatible(spec.conv[4], u_tr_arg_conversion<const char *>()));
+}
+
+TEST_CASE("literal traces round trip through the ring", "[trace]") {
+    u_tr(T_info, "writer %u started, %d pending, ratio %.2f", 7u, -3, 0.25);
+    REQUIRE(last_trace() == "writer 7 started, -3 pending, ratio 0.25");
+
+    u_tr(T_info, "dsp %s id=%016llx %c %%", "alpha", 0xabcull, 'x');
+    REQUIRE(last_trace() == "dsp alpha id=0000000000000abc x %");
+}
+
+TEST_CASE("pointers keep the arguments after them in place", "[trace]") {
+    const char *const text = "hello world";
+    u_tr(T_info, "ptr %p then %d", static_cast<const void *>(text), 5);
+    char expected[64];
+    std::snprintf(expected, sizeof(expected), "ptr %p then 5", static_cast<const void *>(text));
+    REQUIRE(last_trace() == expected);
+}
+
+TEST_CASE("long string arguments are truncated, not overflowed", "[trace]") {
+    u_tr(T_info, "[%s]", "a string much longer than the record keeps");
+    REQUIRE(last_trace() == "[a string much lo]");
+}
+
+TEST_CASE("suppressed traces do not reach the ring", "[trace]") {
+    const uint64_t head = u_tr_ring.head();
+    u_tr(T_dbg, "debug %d", 1);
+    REQUIRE(u_tr_ring.head() == head);
+}
+
+TEST_CASE("formats register once however their slots collide", "[trace]") {
+    UTrFormatRegistry registry;
+    int registered = 0;
+    registry.set_listener([](void *context, uint32_t, const char *) { ++*static_cast<int *>(context); },
+                          &registered);
+
+    // Same table slot, different hashes: both stay registered
+    static const char first[] = "first %d";
+    static const char second[] = "second %d";
+    const uint32_t hash = 7;
+    for (int i = 0; i < 100; i++) {
+        registry.note(hash, first);
+        registry.note(hash + UTrFormatRegistry::SITE_slots, second);
+    }
+    REQUIRE(registered == 2);
+    REQUIRE(registry.sites[hash].load() == first);
+    REQUIRE(registry.sites[hash + 1].load() == second);
+    REQUIRE(std::strcmp(registry.lookup(hash), first) == 0);
+    REQUIRE(std::strcmp(registry.lookup(hash + UTrFormatRegistry::SITE_slots), second) == 0);
+}
+
+TEST_CASE("formats sharing a hash decode as a collision", "[trace]") {
+    UTrFormatRegistry registry;
+    static const char text[] = "same %d";
+    static const char copy[] = "same %d";
+    static const char other[] = "other %d";
+    const uint32_t hash = 42;
+
+    // The same text at another address is the same format
+    registry.note(hash, text);
+    registry.note(hash, copy);
+    REQUIRE(registry.lookup(hash) == text);
+
+    registry.note(hash, other);
+    REQUIRE(registry.lookup(hash) == U_TR_FORMAT_collision);
+
+    UTrRecord record = {};
+    record.format_hash = hash;
+    char decoded[64];
+    REQUIRE(u_tr_decode(registry.lookup(hash), record, decoded, sizeof(decoded)) >= 0);
+    REQUIRE(std::string(decoded) == U_TR_FORMAT_collision);
+}
@@ -0,0 +1,43 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "u_tr_level.h"
+
+TEST_CASE("everything is compiled in by default", "[trace]") {
+    STATIC_REQUIRE(u_tr_compiled_in(0, T_dbg));
+    STATIC_REQUIRE(u_tr_compiled_in(U_TR_MAX_modules - 1, T_error));
+}
+
+TEST_CASE("runtime thresholds are per module", "[trace]") {
+    constexpr int module = 7;
+    REQUIRE(u_tr_get_threshold(module) == U_TR_DEFAULT_threshold);
+    REQUIRE_FALSE(u_tr_enabled(module, T_dbg));
+    REQUIRE(u_tr_enabled(module, T_info));
+
+    u_tr_set_threshold(module, T_dbg);
+    REQUIRE(u_tr_enabled(module, T_dbg));
+    REQUIRE_FALSE(u_tr_enabled(module + 1, T_dbg));
+
+    u_tr_set_threshold(module, T_error);
+    REQUIRE_FALSE(u_tr_enabled(module, T_warn));
+    REQUIRE(u_tr_enabled(module, T_error));
+
+    u_tr_set_threshold(module, U_TR_DEFAULT_threshold);
+}
+
+TEST_CASE("module ids out of range are ignored at run time", "[trace]") {
+    STATIC_REQUIRE(u_tr_module_valid(0));
+    STATIC_REQUIRE_FALSE(u_tr_module_valid(U_TR_MAX_modules));
+    STATIC_REQUIRE_FALSE(u_tr_module_valid(-1));
+
+    for (int module : { -1, U_TR_MAX_modules, 1 << 20 }) {
+        u_tr_set_threshold(module, T_dbg);
+        u_tr_set_debug_sample_period(module, 8);
+        REQUIRE(u_tr_get_threshold(module) == U_TR_DEFAULT_threshold);
+        REQUIRE(u_tr_get_debug_sample_period(module) == 1);
+        REQUIRE_FALSE(u_tr_enabled(module, T_error));
+        REQUIRE_FALSE(u_tr_sampled(module, T_dbg));
+    }
+    // Nothing spilled into the first or last real module
+    REQUIRE(u_tr_get_threshold(0) == U_TR_DEFAULT_threshold);
+    REQUIRE(u_tr_get_threshold(U_TR_MAX_modules - 1) == U_TR_DEFAULT_threshold);
+}
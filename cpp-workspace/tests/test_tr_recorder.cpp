@@ -0,0 +1,125 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "u_tr_recorder.h"
+
+namespace {
+
+std::string temp_path(const char *name) {
+    return "/tmp/" + std::string(name) + "." + std::to_string(getpid());
+}
+
+// Decode every record of a recorder file into one string
+std::string dump(const UTrRecorderImage& image) {
+    char *buf = nullptr;
+    size_t size = 0;
+    FILE *out = open_memstream(&buf, &size);
+    image.dump(out);
+    std::fclose(out);
+    std::string text(buf, size);
+    std::free(buf);
+    return text;
+}
+
+} // namespace
+
+TEST_CASE("flight recorder survives an abort", "[trace]") {
+    const std::string path = temp_path("u_tr_recorder");
+    const pid_t child = fork();
+    REQUIRE(child >= 0);
+    if (child == 0) {
+        u_tr(T_info, "before open %d", 1);
+        if (u_tr_flight_recorder_open(path.c_str(), 1024) != 0) {
+            _exit(1);
+        }
+        for (int i = 0; i < 2000; i++) {
+            u_tr(T_info, "step %d of %s", i, "crash");
+        }
+        u_tr(T_error, "last words %llx", 0xdeadull);
+        // Die the hard way, not through the test framework's handler
+        std::signal(SIGABRT, SIG_DFL);
+        std::abort();
+    }
+    int status;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFSIGNALED(status));
+    REQUIRE(WTERMSIG(status) == SIGABRT);
+
+    UTrRecorderImage image;
+    REQUIRE(image.open(path.c_str()) == 0);
+    REQUIRE(image.header().pid == child);
+    REQUIRE(image.ring().head() >= 2002);
+
+    const std::string text = dump(image);
+    REQUIRE(text.find("last words dead") != std::string::npos);
+    REQUIRE(text.find("step 1999 of crash") != std::string::npos);
+    // Only the last 1024 records are kept
+    REQUIRE(text.find("step 0 of crash") == std::string::npos);
+    REQUIRE(text.find("<unknown format>") == std::string::npos);
+    unlink(path.c_str());
+}
+
+TEST_CASE("snapshots carry what is needed to decode them", "[trace]") {
+    const std::string path = temp_path("u_tr_snapshot");
+    u_tr(T_warn, "snapshot marker %u", 77u);
+
+    uint64_t records = 0;
+    REQUIRE(u_tr_snapshot(path.c_str(), &records) == 0);
+    REQUIRE(records > 0);
+
+    UTrRecorderImage image;
+    REQUIRE(image.open(path.c_str()) == 0);
+    const std::string text = dump(image);
+    REQUIRE(text.find("snapshot marker 77") != std::string::npos);
+    REQUIRE(text.find(" ? ") == std::string::npos);
+    unlink(path.c_str());
+}
+
+TEST_CASE("files that are not recorder files are rejected", "[trace]") {
+    const std::string path = temp_path("u_tr_not_recorder");
+    FILE *f = std::fopen(path.c_str(), "w");
+    REQUIRE(f != nullptr);
+    std::fputs("hello", f);
+    std::fclose(f);
+
+    UTrRecorderImage image;
+    REQUIRE(image.open(path.c_str()) == EINVAL);
+    REQUIRE(image.open("/nonexistent/u_tr_recorder") == ENOENT);
+    unlink(path.c_str());
+}
+
+TEST_CASE("recorder headers that point outside the file are rejected", "[trace]") {
+    const std::string path = temp_path("u_tr_bad_header");
+    struct Patch {
+        size_t offset;
+        uint64_t value;
+    };
+    // Each value would wrap an unchecked offset + size sum past the file size
+    const Patch patches[] = {
+        { offsetof(UTrRecorderHeader, ring_capacity), uint64_t(1) << 62 },
+        { offsetof(UTrRecorderHeader, ring_offset), UINT64_MAX - 63 },
+        { offsetof(UTrRecorderHeader, formats_size), UINT64_MAX - 4095 },
+        { offsetof(UTrRecorderHeader, bases_offset), UINT64_MAX - 7 },
+        { offsetof(UTrRecorderHeader, ring_offset), 4097 },
+    };
+    for (const Patch& patch : patches) {
+        REQUIRE(u_tr_snapshot(path.c_str()) == 0);
+        const int fd = ::open(path.c_str(), O_WRONLY);
+        REQUIRE(fd >= 0);
+        REQUIRE(pwrite(fd, &patch.value, sizeof(patch.value), patch.offset) == sizeof(patch.value));
+        close(fd);
+
+        UTrRecorderImage image;
+        REQUIRE(image.open(path.c_str()) == EINVAL);
+    }
+    unlink(path.c_str());
+}
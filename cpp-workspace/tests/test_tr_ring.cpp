@@ -0,0 +1,68 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <thread>
+#include <vector>
+
+#include "u_tr_ring.h"
+
+TEST_CASE("ring records round trip", "[trace]") {
+    UTrRing ring(8);
+    const uint32_t arg = 42;
+    REQUIRE(ring.write(0x1234, 7, 1, UTrStamp{3, 99}, &arg, sizeof(arg)) == 0);
+    REQUIRE(ring.head() == 1);
+
+    UTrRecord record;
+    REQUIRE(ring.read(0, &record));
+    REQUIRE(record.format_hash == 0x1234);
+    REQUIRE(record.module == 7);
+    REQUIRE(record.level == 1);
+    REQUIRE(record.epoch == 3);
+    REQUIRE(record.tsc_delta == 99);
+    REQUIRE(record.payload_size == sizeof(arg));
+    uint32_t out;
+    std::memcpy(&out, record.payload, sizeof(out));
+    REQUIRE(out == 42);
+
+    REQUIRE_FALSE(ring.read(1, &record));
+}
+
+TEST_CASE("ring overwrites the oldest records", "[trace]") {
+    UTrRing ring(4);
+    for (uint32_t i = 0; i < 6; i++) {
+        ring.write(i, 0, 0, UTrStamp{}, nullptr, 0);
+    }
+
+    UTrRecord record;
+    REQUIRE_FALSE(ring.read(0, &record));
+    REQUIRE_FALSE(ring.read(1, &record));
+    for (uint64_t i = 2; i < 6; i++) {
+        REQUIRE(ring.read(i, &record));
+        REQUIRE(record.format_hash == i);
+    }
+}
+
+TEST_CASE("concurrent writers claim distinct records", "[trace]") {
+    UTrRing ring(1 << 12);
+    std::vector<std::thread> threads;
+    for (uint16_t t = 0; t < 4; t++) {
+        threads.emplace_back([&ring, t] {
+            for (uint32_t i = 0; i < 1000; i++) {
+                ring.write(i, t, 0, UTrStamp{}, &i, sizeof(i));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    REQUIRE(ring.head() == 4000);
+    uint32_t per_module[4] = {};
+    UTrRecord record;
+    for (uint64_t i = 0; i < ring.head(); i++) {
+        REQUIRE(ring.read(i, &record));
+        per_module[record.module]++;
+    }
+    for (uint32_t count : per_module) {
+        REQUIRE(count == 1000);
+    }
+}